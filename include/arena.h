@@ -0,0 +1,42 @@
+/*
+ * DaOS - Simple Operating System
+ * Copyright (C) 2025 Mostafizur Rahman
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include "types.h"
+
+#define ARENA_ALIGNMENT 8
+
+typedef struct arena {
+    uint8* base;
+    uint32 size;
+    uint32 offset;
+    uint32 peak;
+} arena_t;
+
+typedef uint32 arena_mark_t;
+
+void arena_init(arena_t* arena, void* buffer, uint32 size);
+void* arena_alloc(arena_t* arena, uint32 size);
+arena_mark_t arena_mark(arena_t* arena);
+void arena_release(arena_t* arena, arena_mark_t mark);
+void arena_reset(arena_t* arena);
+uint32 arena_used(arena_t* arena);
+
+#endif
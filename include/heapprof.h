@@ -0,0 +1,61 @@
+/*
+ * DaOS - Simple Operating System
+ * Copyright (C) 2025 Mostafizur Rahman
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef HEAPPROF_H
+#define HEAPPROF_H
+
+#include "types.h"
+
+#define HEAPPROF_MAX_SITES 64
+#define HEAPPROF_MAX_LIVE 1024
+#define HEAPPROF_HISTOGRAM_BUCKETS 24
+#define HEAPPROF_TOP_COUNT 8
+
+typedef struct heapprof_site {
+    uintptr address;
+    uint32 alloc_count;
+    uint32 free_count;
+    uint64 alloc_bytes;
+    uint32 live_bytes;
+    uint64 total_lifetime;
+} heapprof_site_t;
+
+typedef struct heapprof_live {
+    uintptr ptr;
+    uint32 size;
+    uint32 site;
+    uint32 tick;
+} heapprof_live_t;
+
+typedef struct heapprof_stats {
+    uint32 histogram[HEAPPROF_HISTOGRAM_BUCKETS];
+    uint32 dropped_sites;
+    uint32 dropped_live;
+} heapprof_stats_t;
+
+void heapprof_enable();
+void heapprof_disable();
+void heapprof_reset();
+int heapprof_is_enabled();
+
+void heapprof_record_alloc(void* ptr, uint32 size, uintptr site);
+void heapprof_record_free(void* ptr);
+
+void heapprof_print();
+
+#endif
@@ -31,6 +31,8 @@
 #define KEY_RIGHT 0x4D
 #define KEY_ESC 0x01
 
+#define READSTR_BUFFER_SIZE 100
+
 string readStr();
 char readKeys();
 uint8 read_scancode();
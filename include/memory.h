@@ -22,8 +22,15 @@
 #include "types.h"
 #include "screen.h"
 
-#define HEAP_START 0x100000
-#define HEAP_SIZE 0x100000
+#define HEAP_INITIAL_SIZE 0x100000
+#define HEAP_GROW_SIZE 0x40000
+#define HEAP_TRIM_THRESHOLD 0x40000
+#define HEAP_BOOT_ARENAS 32
+#define HEAP_FREE_BINS 24
+#define HEAP_MAP_COLUMNS 64
+#define HEAP_MAP_DEFAULT_KIB 4
+#define PAGE_ALLOC_SLOTS 256
+#define PAGE_ALLOC_TOMBSTONE 1
 #define MEM_BLOCK_SIZE 16
 #define HEAP_MAGIC 0xDEADBEEF
 #define MIN_ALLOC_SIZE 16
@@ -43,6 +50,25 @@ typedef struct memory_block {
     struct memory_block* prev;
 } memory_block_t;
 
+typedef struct memory_footer {
+    uint64 size;
+    uint32 magic;
+    int is_free;
+} memory_footer_t;
+
+#define BLOCK_OVERHEAD (sizeof(memory_block_t) + sizeof(memory_footer_t))
+#define HEAP_ARENA_OVERHEAD (sizeof(memory_footer_t) + sizeof(memory_block_t))
+
+typedef struct heap_arena {
+    uintptr start;
+    uintptr end;
+} heap_arena_t;
+
+typedef struct page_alloc {
+    uintptr addr;
+    uint32 pages;
+} page_alloc_t;
+
 typedef struct heap_stats {
     uint32 total_size;
     uint32 used_size;
@@ -51,6 +77,9 @@ typedef struct heap_stats {
     uint32 num_allocs;
     uint32 num_frees;
     uint32 num_coalesces;
+    uint32 num_free_blocks;
+    uint32 largest_free;
+    uint32 free_bins[HEAP_FREE_BINS];
 } heap_stats_t;
 
 void init_memory();
@@ -63,11 +92,15 @@ void kfree(void* ptr);
 void set_alloc_strategy(alloc_strategy_t strategy);
 void print_memory_stats();
 void print_heap_blocks();
+void print_heap_map(uint32 kib_per_char);
 uint32 get_free_memory();
 uint32 get_used_memory();
 heap_stats_t* get_heap_stats();
+uint32 get_largest_free_block();
+uint32 get_heap_fragmentation();
+int heap_can_allocate(uint32 size);
 
-void* kmalloc_p(size_t size, uint32* phys);
-void* kmalloc_ap(size_t size, size_t alignment, uint32* phys);
+void* kmalloc_p(size_t size, uintptr* phys);
+void* kmalloc_ap(size_t size, size_t alignment, uintptr* phys);
 
 #endif
@@ -20,12 +20,12 @@
 #define PAGING_H
 
 #include "types.h"
+#include "vma.h"
 
 #define PAGE_SIZE 4096
-#define PAGE_DIRECTORY_SIZE 1024
-#define PAGE_TABLE_SIZE 1024
-#define PAGES_PER_TABLE 1024
-#define PAGES_PER_DIR 1024
+#define PAGE_SIZE_2M 0x200000ULL
+#define PAGE_SIZE_1G 0x40000000ULL
+#define PAGE_ENTRIES 512
 
 #define PAGE_PRESENT 0x1
 #define PAGE_WRITE 0x2
@@ -34,69 +34,83 @@
 #define PAGE_CACHE_DISABLE 0x10
 #define PAGE_ACCESSED 0x20
 #define PAGE_DIRTY 0x40
-#define PAGE_SIZE_4MB 0x80
+#define PAGE_HUGE 0x80
 #define PAGE_GLOBAL 0x100
+#define PAGE_COW 0x200
+#define PAGE_NX 0x8000000000000000ULL
 
-#define PAGE_FRAME 0xFFFFF000
-
-typedef uint32 page_t;
-typedef uint32 page_table_t[PAGE_TABLE_SIZE];
-typedef uint32 page_directory_t[PAGE_DIRECTORY_SIZE];
-
-typedef struct page_directory_entry {
-    uint32 present : 1;
-    uint32 read_write : 1;
-    uint32 user_supervisor : 1;
-    uint32 write_through : 1;
-    uint32 cache_disable : 1;
-    uint32 accessed : 1;
-    uint32 reserved : 1;
-    uint32 page_size : 1;
-    uint32 global : 1;
-    uint32 available : 3;
-    uint32 frame : 20;
-} __attribute__((packed)) page_directory_entry_t;
-
-typedef struct page_table_entry {
-    uint32 present : 1;
-    uint32 read_write : 1;
-    uint32 user_supervisor : 1;
-    uint32 write_through : 1;
-    uint32 cache_disable : 1;
-    uint32 accessed : 1;
-    uint32 dirty : 1;
-    uint32 reserved : 1;
-    uint32 global : 1;
-    uint32 available : 3;
-    uint32 frame : 20;
-} __attribute__((packed)) page_table_entry_t;
+#define PAGE_KERNEL (PAGE_PRESENT | PAGE_WRITE | PAGE_GLOBAL)
+
+#define CR0_WP (1 << 16)
+#define CR4_PGE (1 << 7)
+#define CR4_PCIDE (1 << 17)
+#define CR3_NOFLUSH (1ULL << 63)
+
+#define TLB_FLUSH_THRESHOLD 32
+#define TLB_BATCH_FRAMES 64
+#define UNMAP_FREE_FRAMES 0x1
+
+#define PCID_NONE 0
+#define PCID_SLOTS 64
+
+#define PAGE_FRAME 0x000FFFFFFFFFF000ULL
+#define PAGE_FLAGS_MASK (0xFFFULL | PAGE_NX)
+
+#define PML4_SHIFT 39
+#define PDPT_SHIFT 30
+#define PD_SHIFT 21
+#define PT_SHIFT 12
+#define PAGE_INDEX(addr, shift) (((addr) >> (shift)) & (PAGE_ENTRIES - 1))
+
+#define PHYS_TO_VIRT(addr) ((void*)(uintptr)(addr))
+
+typedef uint64 page_t;
+
+typedef struct page_table {
+    page_t entries[PAGE_ENTRIES];
+} __attribute__((aligned(PAGE_SIZE))) page_table_t;
 
 typedef struct page_directory_struct {
-    page_directory_t directory;
-    page_table_t* tables[PAGES_PER_DIR];
-    uint32 physical_tables[PAGES_PER_DIR];
-    uint32 physical_addr;
+    page_table_t* pml4;
+    uint64 physical_addr;
+    volatile uint64 tlb_gen;
+    vma_t* vmas;
 } page_directory_struct_t;
 
+typedef struct pcid_slot {
+    page_directory_struct_t* dir;
+    uint64 tlb_gen;
+} pcid_slot_t;
+
 void init_paging();
-void enable_paging();
+void paging_init_ap();
+int paging_supports_1g();
+int paging_pcid_enabled();
 void switch_page_directory(page_directory_struct_t* dir);
 page_directory_struct_t* get_kernel_directory();
 page_directory_struct_t* get_current_directory();
 page_directory_struct_t* clone_directory(page_directory_struct_t* src);
+void free_directory(page_directory_struct_t* dir);
 
-void map_page(uint32 virtual_addr, uint32 physical_addr, uint32 flags);
-void unmap_page(uint32 virtual_addr);
-uint32 get_physical_address(uint32 virtual_addr);
-void* get_page(uint32 virtual_addr, int make, page_directory_struct_t* dir);
+int map_page(uint64 virtual_addr, uint64 physical_addr, uint64 flags);
+int map_page_size(page_directory_struct_t* dir, uint64 virtual_addr, uint64 physical_addr, uint64 flags, uint64 page_size);
+void unmap_page(uint64 virtual_addr);
+int map_range(page_directory_struct_t* dir, uint64 virtual_addr, uint64 physical_addr, uint64 size, uint64 flags);
+void unmap_range(page_directory_struct_t* dir, uint64 virtual_addr, uint64 size, uint32 unmap_flags);
+uint64 get_physical_address(uint64 virtual_addr);
+page_t* get_page(uint64 virtual_addr, int make, page_directory_struct_t* dir);
 
-void page_fault_handler(uint32 error_code);
-void flush_tlb_entry(uint32 virtual_addr);
+int handle_cow_fault(uint64 virtual_addr);
+int handle_demand_fault(uint64 virtual_addr, uint64 error_code);
+void page_fault_handler(uint64 error_code);
+void flush_tlb_entry(uint64 virtual_addr);
 void flush_tlb();
+void flush_tlb_all();
+void tlb_shootdown_service();
 
 void* valloc(uint32 size);
 void vfree(void* ptr);
 void map_kernel_space();
-void identity_map(uint32 start, uint32 end);
+void identity_map(uint64 start, uint64 end);
 
 #endif
@@ -23,48 +23,114 @@
 
 #define PMM_BLOCK_SIZE 4096
 #define PMM_BLOCKS_PER_BYTE 8
-#define MAX_MEMORY_SIZE 0x10000000
-#define MEMORY_MAP_SIZE (MAX_MEMORY_SIZE / PMM_BLOCK_SIZE / PMM_BLOCKS_PER_BYTE)
+#define PMM_MAX_ORDER 10
+#define PMM_MAX_REGIONS 32
+#define PMM_BOOT_MAPPED_LIMIT 0x40000000ULL
+#define PMM_FALLBACK_MEMORY_SIZE 0x1000000
 
-typedef struct multiboot_memory_map {
+#define PMM_ZONE_DMA 0
+#define PMM_ZONE_DMA32 1
+#define PMM_ZONE_NORMAL 2
+#define PMM_ZONE_COUNT 3
+#define PMM_ZONE_DMA_LIMIT 0x1000000ULL
+#define PMM_ZONE_DMA32_LIMIT 0x100000000ULL
+#define PMM_ZONE_RESERVE_RATIO 4
+
+#define PMM_ALLOC_ZERO 0x1
+#define PMM_ZERO_POOL_ORDERS 2
+#define PMM_ZERO_POOL_SIZE 32
+
+#define MULTIBOOT2_BOOTLOADER_MAGIC 0x36D76289
+#define MULTIBOOT_TAG_TYPE_END 0
+#define MULTIBOOT_TAG_TYPE_MMAP 6
+#define MULTIBOOT_MEMORY_AVAILABLE 1
+
+typedef struct pmm_bitmap {
+    uint64* leaf;
+    uint64* summary;
+    uint32 leaf_words;
+    uint32 summary_words;
+    uint32 hint;
+} pmm_bitmap_t;
+
+typedef struct pmm_zone {
+    char* name;
+    uint32 start;
+    uint32 end;
+    uint32 managed_blocks;
+    uint32 free_blocks;
+    uint32 watermark;
+    pmm_bitmap_t free_map[PMM_MAX_ORDER + 1];
+    uint32 free_count[PMM_MAX_ORDER + 1];
+} pmm_zone_t;
+
+typedef struct pmm_zero_pool {
+    uint64 blocks[PMM_ZERO_POOL_SIZE];
+    uint32 count;
+    uint32 target;
+} pmm_zero_pool_t;
+
+typedef struct pmm_region {
+    uint64 base;
+    uint64 size;
+} pmm_region_t;
+
+typedef struct multiboot_info {
+    uint32 total_size;
+    uint32 reserved;
+} __attribute__((packed)) multiboot_info_t;
+
+typedef struct multiboot_tag {
+    uint32 type;
+    uint32 size;
+} __attribute__((packed)) multiboot_tag_t;
+
+typedef struct multiboot_tag_mmap {
+    uint32 type;
     uint32 size;
-    uint32 base_addr_low;
-    uint32 base_addr_high;
-    uint32 length_low;
-    uint32 length_high;
+    uint32 entry_size;
+    uint32 entry_version;
+} __attribute__((packed)) multiboot_tag_mmap_t;
+
+typedef struct multiboot_memory_map {
+    uint64 addr;
+    uint64 len;
     uint32 type;
+    uint32 reserved;
 } __attribute__((packed)) multiboot_memory_map_t;
 
-typedef struct multiboot_info {
-    uint32 flags;
-    uint32 mem_lower;
-    uint32 mem_upper;
-    uint32 boot_device;
-    uint32 cmdline;
-    uint32 mods_count;
-    uint32 mods_addr;
-    uint32 syms[4];
-    uint32 mmap_length;
-    uint32 mmap_addr;
-} __attribute__((packed)) multiboot_info_t;
+uint64 pmm_metadata_size(uint64 total_memory);
+void init_pmm(uint64 total_memory, void* metadata);
+void init_pmm_multiboot(multiboot_info_t* info);
+void pmm_init_region(uint64 base, uint64 size);
+void pmm_init_high_memory();
+void pmm_deinit_region(uint64 base, uint64 size);
 
-void init_pmm(uint32 total_memory);
-void pmm_init_region(uint32 base, uint32 size);
-void pmm_deinit_region(uint32 base, uint32 size);
+uint64 pmm_allocate_page();
+void pmm_free_page(uint64 page);
+uint64 pmm_allocate_pages(uint32 count);
+uint64 pmm_allocate_page_flags(uint32 flags);
+uint64 pmm_allocate_pages_flags(uint32 count, uint32 flags);
+void pmm_free_pages(uint64 page, uint32 count);
 
-uint32 pmm_allocate_page();
-void pmm_free_page(uint32 page);
-uint32 pmm_allocate_pages(uint32 count);
-void pmm_free_pages(uint32 page, uint32 count);
+void pmm_ref_page(uint64 page);
+void pmm_unref_page(uint64 page);
+uint32 pmm_get_page_refcount(uint64 page);
 
-uint32 pmm_get_total_memory();
-uint32 pmm_get_free_memory();
-uint32 pmm_get_used_memory();
+uint64 pmm_get_total_memory();
+uint64 pmm_get_free_memory();
+uint64 pmm_get_used_memory();
 uint32 pmm_get_block_count();
+pmm_region_t* pmm_get_regions(uint32* count);
+pmm_zone_t* pmm_get_zone(uint32 zone);
 
-int pmm_is_page_allocated(uint32 page);
+int pmm_is_page_allocated(uint64 page);
 void pmm_print_stats();
 
-uint32 pmm_allocate_dma_pages(uint32 count);
+uint64 pmm_allocate_zone_pages(uint32 zone, uint32 count);
+uint64 pmm_allocate_dma_pages(uint32 count);
+
+int pmm_refill_zero_pool();
+void pmm_drain_zero_pool();
 
 #endif
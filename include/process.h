@@ -21,13 +21,29 @@
 
 #include "types.h"
 #include "memory.h"
+#include "timer.h"
+#include "rbtree.h"
+#include "spinlock.h"
 
 #define MAX_PROCESSES 32
 #define PROCESS_STACK_SIZE 8192
+#define PROCESS_STACK_PAGES (PROCESS_STACK_SIZE / 4096)
 #define DEFAULT_TIME_SLICE 10
 #define MIN_PRIORITY 1
 #define MAX_PRIORITY 20
 #define DEFAULT_PRIORITY 10
+#define PRIORITY_LEVELS (MAX_PRIORITY + 1)
+
+#define SCHED_POLICY_FAIR 0
+#define SCHED_POLICY_PRIORITY 1
+#define SCHED_POLICY_IDLE 2
+
+#define FAIR_WEIGHT_DEFAULT 1024
+#define FAIR_VRUNTIME_SHIFT 10
+#define FAIR_TARGET_LATENCY 20
+#define FAIR_MIN_GRANULARITY 2
+#define FAIR_WAKEUP_GRANULARITY (1ULL << FAIR_VRUNTIME_SHIFT)
+#define FAIR_SLEEPER_CREDIT ((uint64)(FAIR_TARGET_LATENCY / 2) << FAIR_VRUNTIME_SHIFT)
 
 #define PROCESS_STATE_READY 0
 #define PROCESS_STATE_RUNNING 1
@@ -35,16 +51,16 @@
 #define PROCESS_STATE_TERMINATED 3
 #define PROCESS_STATE_ZOMBIE 4
 #define PROCESS_STATE_SLEEPING 5
+#define PROCESS_STATE_MIGRATING 6
 
 typedef struct cpu_state {
-    uint32 eax, ebx, ecx, edx;
-    uint32 esi, edi, ebp;
-    uint32 eip, esp, ebp_saved;
-    uint32 eflags;
-    uint32 cr3;
-    uint16 cs, ds, es, fs, gs, ss;
+    uint64 r15, r14, r13, r12, r11, r10, r9, r8;
+    uint64 rbp, rdi, rsi, rdx, rcx, rbx, rax;
+    uint64 rip, cs, rflags, rsp, ss;
 } cpu_state_t;
 
+struct run_queue;
+
 typedef struct process {
     uint32 pid;
     uint32 ppid;
@@ -53,20 +69,61 @@ typedef struct process {
     uint32 time_slice;
     uint32 quantum_used;
     uint64 total_time;
-    cpu_state_t cpu;
-    uint32* stack;
+    uint64 kernel_rsp;
+    uint64* stack;
     uint32 stack_size;
     void* page_directory;
     char name[32];
     uint32 sleep_until;
+    timer_entry_t sleep_timer;
     uint32 exit_code;
+    struct process* run_next;
+    struct process* run_prev;
+    struct run_queue* run_queue;
+    uint32 policy;
+    uint32 weight;
+    uint64 vruntime;
+    rb_node_t fair_node;
+    uint32 fair_queued;
+    uint32 last_cpu;
+    uint32 cpu_affinity;
 } process_t;
 
+typedef struct run_queue {
+    process_t* head[PRIORITY_LEVELS];
+    process_t* tail[PRIORITY_LEVELS];
+    uint32 bitmap;
+    uint32 count;
+} run_queue_t;
+
+typedef struct fair_queue {
+    rb_root_t tasks;
+    uint64 min_vruntime;
+    uint64 total_weight;
+    uint32 count;
+} fair_queue_t;
+
+typedef struct cpu_run_queue {
+    spinlock_t lock;
+    run_queue_t queues[2];
+    run_queue_t* active;
+    run_queue_t* expired;
+    fair_queue_t fair;
+    process_t* current;
+    process_t* previous;
+    process_t* idle;
+    process_t* migrate;
+    uint32 cpu;
+    uint32 nr_running;
+    int need_resched;
+} cpu_run_queue_t;
+
 typedef struct sched_stats {
     uint32 context_switches;
     uint32 processes_created;
     uint32 processes_terminated;
     uint64 total_scheduler_time;
+    uint32 migrations;
 } sched_stats_t;
 
 void init_process_manager();
@@ -85,6 +142,10 @@ process_t* get_current_process();
 process_t* get_process_by_pid(uint32 pid);
 
 void set_process_priority(uint32 pid, uint32 priority);
+void set_process_policy(uint32 pid, uint32 policy);
+void set_process_affinity(uint32 pid, uint32 mask);
+void sched_init_cpu(uint32 cpu);
+void sched_idle_loop();
 void block_process(uint32 pid);
 void unblock_process(uint32 pid);
 
@@ -93,7 +154,9 @@ sched_stats_t* get_scheduler_stats();
 void print_scheduler_stats();
 
 void switch_to_process(process_t* proc);
-void save_context(cpu_state_t* cpu);
-void load_context(cpu_state_t* cpu);
+void process_bootstrap(void (*entry_point)());
+
+extern void switch_context(uint64* old_rsp, uint64 new_rsp);
+extern void process_start();
 
 #endif
@@ -0,0 +1,49 @@
+/*
+ * DaOS - Simple Operating System
+ * Copyright (C) 2025 Mostafizur Rahman
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef RBTREE_H
+#define RBTREE_H
+
+#include "types.h"
+
+#define RB_RED 0
+#define RB_BLACK 1
+
+typedef struct rb_node {
+    struct rb_node* parent;
+    struct rb_node* left;
+    struct rb_node* right;
+    int color;
+} rb_node_t;
+
+typedef struct rb_root {
+    rb_node_t* node;
+} rb_root_t;
+
+#define rb_entry(ptr, type, member) ((type*)((uint8*)(ptr) - __builtin_offsetof(type, member)))
+
+void rb_link_node(rb_node_t* node, rb_node_t* parent, rb_node_t** link);
+void rb_insert_color(rb_node_t* node, rb_root_t* root);
+void rb_erase(rb_node_t* node, rb_root_t* root);
+
+rb_node_t* rb_first(rb_root_t* root);
+rb_node_t* rb_last(rb_root_t* root);
+rb_node_t* rb_next(rb_node_t* node);
+rb_node_t* rb_prev(rb_node_t* node);
+
+#endif
@@ -0,0 +1,56 @@
+/*
+ * DaOS - Simple Operating System
+ * Copyright (C) 2025 Mostafizur Rahman
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef SLAB_H
+#define SLAB_H
+
+#include "types.h"
+
+#define SLAB_PAGE_SIZE 4096
+#define SLAB_MAGIC 0x51AB51AB
+#define SLAB_MIN_SIZE 16
+#define SLAB_MAX_SIZE 2048
+#define SLAB_NUM_CLASSES 8
+
+typedef struct slab {
+    uint32 magic;
+    uint16 size_class;
+    uint16 in_use;
+    uint32 capacity;
+    void* free_list;
+    struct slab* next;
+    struct slab* prev;
+} slab_t;
+
+typedef struct slab_cache {
+    uint32 object_size;
+    slab_t* partial;
+    slab_t* full;
+    slab_t* empty;
+    uint32 num_slabs;
+    uint32 num_allocs;
+    uint32 num_frees;
+} slab_cache_t;
+
+void init_slab();
+void* slab_alloc(size_t size);
+int slab_free(void* ptr);
+uint32 slab_object_size(void* ptr);
+void slab_print_stats();
+
+#endif
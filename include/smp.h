@@ -0,0 +1,139 @@
+/*
+ * DaOS - Simple Operating System
+ * Copyright (C) 2025 Mostafizur Rahman
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef SMP_H
+#define SMP_H
+
+#include "types.h"
+#include "process.h"
+#include "paging.h"
+
+#define MAX_CPUS 16
+#define CPU_ALL_MASK 0xFFFFFFFF
+
+#define AP_TRAMPOLINE_BASE 0x8000
+#define AP_STACK_PAGES 4
+#define AP_STARTUP_TIMEOUT 100
+
+#define IA32_APIC_BASE_MSR 0x1B
+#define IA32_GS_BASE_MSR 0xC0000101
+#define LAPIC_DEFAULT_BASE 0xFEE00000ULL
+
+#define LAPIC_ID 0x020
+#define LAPIC_TPR 0x080
+#define LAPIC_EOI 0x0B0
+#define LAPIC_SVR 0x0F0
+#define LAPIC_ICR_LOW 0x300
+#define LAPIC_ICR_HIGH 0x310
+#define LAPIC_LVT_TIMER 0x320
+#define LAPIC_TIMER_INITIAL 0x380
+#define LAPIC_TIMER_CURRENT 0x390
+#define LAPIC_TIMER_DIVIDE 0x3E0
+
+#define LAPIC_SVR_ENABLE 0x100
+#define LAPIC_ICR_INIT 0x00004500
+#define LAPIC_ICR_STARTUP 0x00004600
+#define LAPIC_ICR_PENDING 0x00001000
+#define LAPIC_TIMER_PERIODIC 0x20000
+#define LAPIC_TIMER_MASKED 0x10000
+
+#define LAPIC_TIMER_VECTOR 48
+#define TLB_SHOOTDOWN_VECTOR 49
+#define LAPIC_SPURIOUS_VECTOR 0xFF
+
+#define MADT_TYPE_LOCAL_APIC 0
+#define MADT_LAPIC_ENABLED 0x1
+
+typedef struct acpi_rsdp {
+    char signature[8];
+    uint8 checksum;
+    char oem_id[6];
+    uint8 revision;
+    uint32 rsdt_address;
+    uint32 length;
+    uint64 xsdt_address;
+    uint8 extended_checksum;
+    uint8 reserved[3];
+} __attribute__((packed)) acpi_rsdp_t;
+
+typedef struct acpi_header {
+    char signature[4];
+    uint32 length;
+    uint8 revision;
+    uint8 checksum;
+    char oem_id[6];
+    char oem_table_id[8];
+    uint32 oem_revision;
+    uint32 creator_id;
+    uint32 creator_revision;
+} __attribute__((packed)) acpi_header_t;
+
+typedef struct acpi_madt {
+    acpi_header_t header;
+    uint32 lapic_address;
+    uint32 flags;
+} __attribute__((packed)) acpi_madt_t;
+
+typedef struct madt_entry {
+    uint8 type;
+    uint8 length;
+} __attribute__((packed)) madt_entry_t;
+
+typedef struct madt_local_apic {
+    madt_entry_t header;
+    uint8 processor_id;
+    uint8 apic_id;
+    uint32 flags;
+} __attribute__((packed)) madt_local_apic_t;
+
+typedef struct cpu {
+    struct cpu* self;
+    uint32 id;
+    uint32 apic_id;
+    volatile uint32 online;
+    uint64 stack;
+    cpu_run_queue_t rq;
+    page_directory_struct_t* page_directory;
+    pcid_slot_t pcid_slots[PCID_SLOTS];
+    uint32 pcid_next;
+} cpu_t;
+
+void init_smp();
+void smp_init_bsp();
+cpu_t* smp_this_cpu();
+cpu_t* smp_get_cpu(uint32 id);
+uint32 smp_cpu_count();
+uint32 smp_online_mask();
+void smp_send_ipi(uint32 mask, uint32 vector);
+void smp_print_info();
+
+void lapic_eoi();
+void apic_timer_handler();
+void tlb_shootdown_handler();
+void ap_main(cpu_t* cpu);
+
+extern void apic_timer_entry();
+extern void tlb_shootdown_entry();
+extern void apic_spurious_entry();
+extern uint8 ap_trampoline_start[];
+extern uint8 ap_trampoline_end[];
+extern uint64 ap_trampoline_cr3;
+extern uint64 ap_trampoline_stack;
+extern uint64 ap_trampoline_cpu;
+
+#endif
@@ -26,5 +26,8 @@ uint8 inportb (uint16 _port);
 void outportb (uint16 _port, uint8 _data);
 uint16 inportw (uint16 _port);
 void outportw (uint16 _port, uint16 _data);
+void cpuid (uint32 leaf, uint32* eax, uint32* ebx, uint32* ecx, uint32* edx);
+uint64 irq_save ();
+void irq_restore (uint64 flags);
 
 #endif
\ No newline at end of file
@@ -22,8 +22,28 @@
 #include "types.h"
 #include "system.h"
 
+#define TIMER_WHEEL_BITS 6
+#define TIMER_WHEEL_SIZE (1 << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_MASK (TIMER_WHEEL_SIZE - 1)
+#define TIMER_WHEEL_LEVELS 4
+#define TIMER_WHEEL_SPAN (1u << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS))
+
+typedef struct timer_entry {
+    struct timer_entry* next;
+    struct timer_entry* prev;
+    struct timer_entry** slot;
+    uint32 expires;
+    void (*callback)(void* data);
+    void* data;
+} timer_entry_t;
+
 void init_timer(uint32 frequency);
 uint32 get_tick_count();
 void sleep(uint32 milliseconds);
 
+void timer_add(timer_entry_t* timer, uint32 expires, void (*callback)(void* data), void* data);
+void timer_cancel(timer_entry_t* timer);
+int timer_pending(timer_entry_t* timer);
+void timer_run();
+
 #endif
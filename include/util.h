@@ -21,14 +21,17 @@
 #define UTIL_H
 
 #include "types.h"
+#include "arena.h"
 
+#define SCRATCH_ARENA_SIZE 16384
 
 void memory_copy(char *source, char *dest, int nbytes);
 void memory_set(uint8 *dest, uint8 val, uint32 len);
 void int_to_ascii(int n, char str[]);  
 void uint_to_hex(uint32 n, char str[]);
 int str_to_int(string ch)  ;
-void * malloc(int nbytes);      
+void * malloc(int nbytes);
+arena_t* get_scratch_arena();
 
 
 #endif
\ No newline at end of file
@@ -0,0 +1,37 @@
+/*
+ * DaOS - Simple Operating System
+ * Copyright (C) 2025 Mostafizur Rahman
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef VMA_H
+#define VMA_H
+
+#include "types.h"
+
+typedef struct vma {
+    uint64 start;
+    uint64 end;
+    uint64 flags;
+    struct vma* next;
+} vma_t;
+
+vma_t* vma_find(vma_t* list, uint64 addr);
+vma_t* vma_insert(vma_t** list, uint64 start, uint64 end, uint64 flags);
+void vma_remove(vma_t** list, vma_t* vma);
+vma_t* vma_clone(vma_t* list);
+void vma_free_all(vma_t** list);
+
+#endif
@@ -0,0 +1,46 @@
+/*
+ * DaOS - Simple Operating System
+ * Copyright (C) 2025 Mostafizur Rahman
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef VSPACE_H
+#define VSPACE_H
+
+#include "types.h"
+#include "rbtree.h"
+
+typedef struct vspace_extent {
+    rb_node_t addr_node;
+    rb_node_t size_node;
+    uint64 start;
+    uint64 size;
+} vspace_extent_t;
+
+typedef struct vspace {
+    rb_root_t by_addr;
+    rb_root_t by_size;
+    uint64 base;
+    uint64 limit;
+    uint64 free_bytes;
+    uint32 extent_count;
+} vspace_t;
+
+int vspace_init(vspace_t* space, uint64 base, uint64 size);
+uint64 vspace_alloc(vspace_t* space, uint64 size);
+void vspace_free(vspace_t* space, uint64 start, uint64 size);
+uint64 vspace_largest_free(vspace_t* space);
+
+#endif
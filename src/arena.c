@@ -0,0 +1,59 @@
+/*
+ * DaOS - Simple Operating System
+ * Copyright (C) 2025 Mostafizur Rahman
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "../include/arena.h"
+
+void arena_init(arena_t* arena, void* buffer, uint32 size) {
+    arena->base = (uint8*)buffer;
+    arena->size = size;
+    arena->offset = 0;
+    arena->peak = 0;
+}
+
+void* arena_alloc(arena_t* arena, uint32 size) {
+    uint32 offset = (arena->offset + ARENA_ALIGNMENT - 1) & ~(ARENA_ALIGNMENT - 1);
+    
+    if (size > arena->size || offset > arena->size - size) {
+        return 0;
+    }
+    
+    arena->offset = offset + size;
+    if (arena->offset > arena->peak) {
+        arena->peak = arena->offset;
+    }
+    
+    return arena->base + offset;
+}
+
+arena_mark_t arena_mark(arena_t* arena) {
+    return arena->offset;
+}
+
+void arena_release(arena_t* arena, arena_mark_t mark) {
+    if (mark <= arena->offset) {
+        arena->offset = mark;
+    }
+}
+
+void arena_reset(arena_t* arena) {
+    arena->offset = 0;
+}
+
+uint32 arena_used(arena_t* arena) {
+    return arena->offset;
+}
@@ -0,0 +1,263 @@
+/*
+ * DaOS - Simple Operating System
+ * Copyright (C) 2025 Mostafizur Rahman
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "../include/heapprof.h"
+#include "../include/screen.h"
+#include "../include/string.h"
+#include "../include/timer.h"
+#include "../include/util.h"
+
+static heapprof_site_t sites[HEAPPROF_MAX_SITES];
+static heapprof_live_t live[HEAPPROF_MAX_LIVE];
+static heapprof_stats_t prof_stats;
+static int prof_enabled = 0;
+
+static uint32 hash_address(uintptr addr) {
+    uint64 h = (uint64)addr * 0x9E3779B97F4A7C15ULL;
+    return (uint32)(h >> 32);
+}
+
+static int find_site(uintptr address) {
+    uint32 slot = hash_address(address) & (HEAPPROF_MAX_SITES - 1);
+    
+    for (uint32 i = 0; i < HEAPPROF_MAX_SITES; i++) {
+        uint32 index = (slot + i) & (HEAPPROF_MAX_SITES - 1);
+        if (sites[index].address == address) {
+            return index;
+        }
+        if (sites[index].address == 0) {
+            sites[index].address = address;
+            return index;
+        }
+    }
+    
+    return -1;
+}
+
+static heapprof_live_t* find_live(uintptr ptr) {
+    uint32 slot = hash_address(ptr) & (HEAPPROF_MAX_LIVE - 1);
+    
+    for (uint32 i = 0; i < HEAPPROF_MAX_LIVE; i++) {
+        heapprof_live_t* entry = &live[(slot + i) & (HEAPPROF_MAX_LIVE - 1)];
+        if (entry->ptr == ptr) {
+            return entry;
+        }
+        if (entry->ptr == 0) {
+            return 0;
+        }
+    }
+    
+    return 0;
+}
+
+static heapprof_live_t* insert_live(uintptr ptr) {
+    uint32 slot = hash_address(ptr) & (HEAPPROF_MAX_LIVE - 1);
+    
+    for (uint32 i = 0; i < HEAPPROF_MAX_LIVE; i++) {
+        heapprof_live_t* entry = &live[(slot + i) & (HEAPPROF_MAX_LIVE - 1)];
+        if (entry->ptr == 0) {
+            entry->ptr = ptr;
+            return entry;
+        }
+    }
+    
+    return 0;
+}
+
+static void remove_live(heapprof_live_t* entry) {
+    uint32 hole = entry - live;
+    uint32 index = hole;
+    
+    while (1) {
+        index = (index + 1) & (HEAPPROF_MAX_LIVE - 1);
+        if (live[index].ptr == 0) {
+            break;
+        }
+        
+        uint32 home = hash_address(live[index].ptr) & (HEAPPROF_MAX_LIVE - 1);
+        if (((index - home) & (HEAPPROF_MAX_LIVE - 1)) >= ((index - hole) & (HEAPPROF_MAX_LIVE - 1))) {
+            live[hole] = live[index];
+            hole = index;
+        }
+    }
+    
+    live[hole].ptr = 0;
+}
+
+static uint32 histogram_bucket(uint32 size) {
+    uint32 bucket = 31 - __builtin_clz(size);
+    if (bucket >= HEAPPROF_HISTOGRAM_BUCKETS) {
+        bucket = HEAPPROF_HISTOGRAM_BUCKETS - 1;
+    }
+    return bucket;
+}
+
+void heapprof_enable() {
+    prof_enabled = 1;
+}
+
+void heapprof_disable() {
+    prof_enabled = 0;
+}
+
+void heapprof_reset() {
+    memset(sites, 0, sizeof(sites));
+    memset(live, 0, sizeof(live));
+    memset(&prof_stats, 0, sizeof(prof_stats));
+}
+
+int heapprof_is_enabled() {
+    return prof_enabled;
+}
+
+void heapprof_record_alloc(void* ptr, uint32 size, uintptr site) {
+    if (!prof_enabled || !ptr || size == 0) {
+        return;
+    }
+    
+    prof_stats.histogram[histogram_bucket(size)]++;
+    
+    int index = find_site(site);
+    if (index < 0) {
+        prof_stats.dropped_sites++;
+        return;
+    }
+    
+    sites[index].alloc_count++;
+    sites[index].alloc_bytes += size;
+    sites[index].live_bytes += size;
+    
+    heapprof_live_t* entry = insert_live((uintptr)ptr);
+    if (!entry) {
+        prof_stats.dropped_live++;
+        return;
+    }
+    
+    entry->size = size;
+    entry->site = index;
+    entry->tick = get_tick_count();
+}
+
+void heapprof_record_free(void* ptr) {
+    if (!prof_enabled || !ptr) {
+        return;
+    }
+    
+    heapprof_live_t* entry = find_live((uintptr)ptr);
+    if (!entry) {
+        return;
+    }
+    
+    heapprof_site_t* site = &sites[entry->site];
+    site->free_count++;
+    site->live_bytes -= entry->size;
+    site->total_lifetime += get_tick_count() - entry->tick;
+    
+    remove_live(entry);
+}
+
+static void print_site(heapprof_site_t* site) {
+    char num_str[20];
+    
+    printf("  0x");
+    uint_to_hex((uint32)site->address, num_str);
+    printf(num_str);
+    printf(" ");
+    int_to_ascii(site->alloc_count, num_str);
+    printf(num_str);
+    printf(" allocs ");
+    int_to_ascii((uint32)site->alloc_bytes, num_str);
+    printf(num_str);
+    printf(" B ");
+    int_to_ascii(site->live_bytes, num_str);
+    printf(num_str);
+    printf(" live");
+    
+    if (site->free_count > 0) {
+        printf(" life ");
+        int_to_ascii((uint32)(site->total_lifetime / site->free_count), num_str);
+        printf(num_str);
+        printf(" ticks");
+    }
+    printf("\n");
+}
+
+static void print_top_sites(int by_bytes) {
+    uint8 printed[HEAPPROF_MAX_SITES];
+    memset(printed, 0, sizeof(printed));
+    
+    for (int n = 0; n < HEAPPROF_TOP_COUNT; n++) {
+        int best = -1;
+        
+        for (int i = 0; i < HEAPPROF_MAX_SITES; i++) {
+            if (sites[i].address == 0 || printed[i]) {
+                continue;
+            }
+            if (best < 0 ||
+                (by_bytes && sites[i].alloc_bytes > sites[best].alloc_bytes) ||
+                (!by_bytes && sites[i].alloc_count > sites[best].alloc_count)) {
+                best = i;
+            }
+        }
+        
+        if (best < 0) {
+            break;
+        }
+        
+        printed[best] = 1;
+        print_site(&sites[best]);
+    }
+}
+
+void heapprof_print() {
+    char num_str[20];
+    
+    printf("Heap Profile (");
+    printf(prof_enabled ? "on" : "off");
+    printf("):\n");
+    
+    printf("Top sites by bytes:\n");
+    print_top_sites(1);
+    
+    printf("Top sites by count:\n");
+    print_top_sites(0);
+    
+    printf("Size histogram:\n");
+    for (int i = 0; i < HEAPPROF_HISTOGRAM_BUCKETS; i++) {
+        if (prof_stats.histogram[i] == 0) {
+            continue;
+        }
+        printf("  >= ");
+        int_to_ascii(1 << i, num_str);
+        printf(num_str);
+        printf(": ");
+        int_to_ascii(prof_stats.histogram[i], num_str);
+        printf(num_str);
+        printf("\n");
+    }
+    
+    if (prof_stats.dropped_sites > 0 || prof_stats.dropped_live > 0) {
+        printf("Dropped: ");
+        int_to_ascii(prof_stats.dropped_sites, num_str);
+        printf(num_str);
+        printf(" sites, ");
+        int_to_ascii(prof_stats.dropped_live, num_str);
+        printf(num_str);
+        printf(" live entries\n");
+    }
+}
@@ -18,6 +18,7 @@
 
 #include "../include/irq.h"
 #include "../include/idt.h"
+#include "../include/process.h"
 
 static irq_handler_t irq_handlers[16] = {0};
 
@@ -68,6 +69,10 @@ void irq_handler(int irq) {
         outportb(PIC2_COMMAND, PIC_EOI);
     }
     outportb(PIC1_COMMAND, PIC_EOI);
+    
+    if(irq == 0) {
+        schedule_irq();
+    }
 }
 
 void irq_set_handler(int irq, irq_handler_t handler) {
@@ -17,6 +17,7 @@
  */
 
 #include "../include/kb.h"
+#include "../include/process.h"
 
 static int capslock_active = 0;
 static int shift_pressed = 0;
@@ -45,7 +46,7 @@ char to_upper(char c) {
 }
 
 string readStr(){
-    string str = (string)malloc(100);
+    string str = (string)malloc(READSTR_BUFFER_SIZE);
     int index = 0;
     while(1){
         char c = readKeys();
@@ -63,7 +64,7 @@ string readStr(){
             printfch('\n');
             return str;
         }
-        else{
+        else if(c != 0 && index < READSTR_BUFFER_SIZE - 1){
             str[index] = c;
             index++;
             printfch(c);
@@ -85,6 +86,9 @@ char readKeys(){
                 break;
             }
         }
+        else{
+            sleep_process(1);
+        }
     }
     
     if(keycode == 0x3A){
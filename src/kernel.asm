@@ -31,6 +31,9 @@ multiboot_header_start:
 multiboot_header_end:
 
 section .bss
+align 8
+multiboot_info:
+    resq 1
 align 4096
 p4_table:
     resb 4096
@@ -48,6 +51,7 @@ extern kmain
 
 start:
     mov esp, stack_top
+    mov [multiboot_info], ebx
     
     call check_multiboot
     call check_cpuid
@@ -155,6 +159,7 @@ long_mode_start:
     mov fs, ax
     mov gs, ax
     
+    mov rdi, [multiboot_info]
     call kmain
     
     cli
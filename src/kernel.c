@@ -27,6 +27,7 @@
 #include "../include/fs.h"
 #include "../include/timer.h"
 #include "../include/process.h"
+#include "../include/smp.h"
 #include "../include/syscall.h"
 #include "../include/hal.h"
 #include "../include/pmm.h"
@@ -35,7 +36,7 @@
 #include "../include/disk.h"
 #include "../include/ext2.h"
 
-void kmain() {
+void kmain(multiboot_info_t* multiboot_info) {
     clearScreen();
     set_screen_color(0x0B, 0x00);
     printf("=================================\n");
@@ -54,14 +55,13 @@ void kmain() {
     irq_install();
     
     printf("[4/14] Initializing Physical Memory Manager...\n");
-    init_pmm(0x1000000);
-    pmm_init_region(0x400000, 0xC00000);
+    init_pmm_multiboot(multiboot_info);
     
     printf("[5/14] Initializing Virtual Memory Manager...\n");
     init_memory();
     
-    printf("[6/14] Initializing Paging (DISABLED for debugging)...\n");
-    printf("  Paging initialization skipped\n");
+    printf("[6/14] Initializing Paging...\n");
+    init_paging();
     
     printf("[7/14] Initializing DMA Allocator...\n");
     init_dma();
@@ -109,13 +109,14 @@ void kmain() {
     __asm__ __volatile__("sti");
     
     printf("Interrupts enabled\n");
+    
+    init_smp();
+    smp_print_info();
     printf("Type 'help' for available commands.\n\n");
     
     printf("Starting shell...\n");
     launch_shell(0);
     printf("Shell exited\n");
     
-    while (1) {
-        __asm__ __volatile__("hlt");
-    }
+    exit_process(0);
 }
\ No newline at end of file
@@ -17,42 +17,269 @@
  */
 
 #include "../include/memory.h"
+#include "../include/slab.h"
+#include "../include/pmm.h"
+#include "../include/heapprof.h"
 #include "../include/util.h"
 #include "../include/string.h"
+#include "../include/spinlock.h"
 
-static memory_block_t* heap_start = 0;
-static uint32 total_memory = HEAP_SIZE;
+static heap_arena_t boot_arenas[HEAP_BOOT_ARENAS];
+static heap_arena_t* heap_arenas = boot_arenas;
+static uint32 max_arenas = HEAP_BOOT_ARENAS;
+static uint32 num_arenas = 0;
+static int heap_initialized = 0;
+static memory_block_t* free_list = 0;
 static uint32 used_memory = 0;
 static alloc_strategy_t current_strategy = ALLOC_FIRST_FIT;
 static heap_stats_t heap_stats;
+static int largest_free_stale = 0;
 
-static uint32 align_up(uint32 addr, uint32 alignment) {
+static page_alloc_t page_allocs[PAGE_ALLOC_SLOTS];
+static spinlock_t heap_lock = SPINLOCK_INIT;
+
+static uintptr align_up(uintptr addr, uintptr alignment) {
     if (alignment == 0) return addr;
     return (addr + alignment - 1) & ~(alignment - 1);
 }
 
+static memory_footer_t* block_footer(memory_block_t* block) {
+    return (memory_footer_t*)((uintptr)block + sizeof(memory_block_t) + block->size);
+}
+
+static void write_footer(memory_block_t* block) {
+    memory_footer_t* footer = block_footer(block);
+    footer->size = block->size;
+    footer->magic = HEAP_MAGIC;
+    footer->is_free = block->is_free;
+}
+
+static memory_block_t* next_block(memory_block_t* block) {
+    return (memory_block_t*)((uintptr)block + BLOCK_OVERHEAD + block->size);
+}
+
+static memory_block_t* prev_block(memory_block_t* block) {
+    memory_footer_t* footer = (memory_footer_t*)((uintptr)block - sizeof(memory_footer_t));
+    if (footer->magic != HEAP_MAGIC || !footer->is_free) {
+        return 0;
+    }
+    return (memory_block_t*)((uintptr)block - BLOCK_OVERHEAD - footer->size);
+}
+
+static int is_epilogue(memory_block_t* block) {
+    return block->size == 0 && !block->is_free;
+}
+
+static uint32 free_bin(uint32 size) {
+    uint32 bin = 31 - __builtin_clz(size);
+    if (bin >= HEAP_FREE_BINS) {
+        bin = HEAP_FREE_BINS - 1;
+    }
+    return bin;
+}
+
+static void free_list_insert(memory_block_t* block) {
+    heap_stats.num_free_blocks++;
+    heap_stats.free_bins[free_bin(block->size)]++;
+    if (block->size > heap_stats.largest_free) {
+        heap_stats.largest_free = block->size;
+    }
+    
+    block->prev = 0;
+    block->next = free_list;
+    if (free_list) {
+        free_list->prev = block;
+    }
+    free_list = block;
+}
+
+static void free_list_remove(memory_block_t* block) {
+    heap_stats.num_free_blocks--;
+    heap_stats.free_bins[free_bin(block->size)]--;
+    if (block->size == heap_stats.largest_free) {
+        largest_free_stale = 1;
+    }
+    
+    if (block->prev) {
+        block->prev->next = block->next;
+    } else {
+        free_list = block->next;
+    }
+    if (block->next) {
+        block->next->prev = block->prev;
+    }
+    block->next = 0;
+    block->prev = 0;
+}
+
+static void write_epilogue(uintptr end) {
+    memory_block_t* epilogue = (memory_block_t*)(end - sizeof(memory_block_t));
+    epilogue->magic = HEAP_MAGIC;
+    epilogue->size = 0;
+    epilogue->is_free = 0;
+    epilogue->next = 0;
+    epilogue->prev = 0;
+}
+
+static int heap_reserve_arena_slot() {
+    if (num_arenas < max_arenas) {
+        return 1;
+    }
+    
+    uint32 pages = align_up(max_arenas * 2 * sizeof(heap_arena_t), PMM_BLOCK_SIZE) / PMM_BLOCK_SIZE;
+    heap_arena_t* table = (heap_arena_t*)pmm_allocate_pages(pages);
+    if (!table) {
+        return 0;
+    }
+    
+    memcpy(table, heap_arenas, num_arenas * sizeof(heap_arena_t));
+    if (heap_arenas != boot_arenas) {
+        pmm_free_pages((uintptr)heap_arenas, align_up(max_arenas * sizeof(heap_arena_t), PMM_BLOCK_SIZE) / PMM_BLOCK_SIZE);
+    }
+    
+    heap_arenas = table;
+    max_arenas = pages * PMM_BLOCK_SIZE / sizeof(heap_arena_t);
+    return 1;
+}
+
+static memory_block_t* heap_add_arena(uint32 pages) {
+    if (!heap_reserve_arena_slot()) {
+        return 0;
+    }
+    
+    uintptr base = pmm_allocate_pages(pages);
+    if (base == 0) {
+        return 0;
+    }
+    
+    uintptr end = base + pages * PMM_BLOCK_SIZE;
+    
+    memory_footer_t* prologue = (memory_footer_t*)base;
+    prologue->size = 0;
+    prologue->magic = HEAP_MAGIC;
+    prologue->is_free = 0;
+    
+    memory_block_t* block = (memory_block_t*)(base + sizeof(memory_footer_t));
+    block->magic = HEAP_MAGIC;
+    block->size = end - (uintptr)block - BLOCK_OVERHEAD - sizeof(memory_block_t);
+    block->is_free = 1;
+    write_footer(block);
+    write_epilogue(end);
+    free_list_insert(block);
+    
+    heap_arenas[num_arenas].start = base;
+    heap_arenas[num_arenas].end = end;
+    num_arenas++;
+    
+    heap_stats.total_size += end - base;
+    heap_stats.free_size += end - base;
+    heap_stats.num_blocks++;
+    
+    return block;
+}
+
+static int heap_find_arena(uintptr addr) {
+    for (uint32 i = 0; i < num_arenas; i++) {
+        if (addr >= heap_arenas[i].start && addr < heap_arenas[i].end) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static int heap_grow(uint32 size) {
+    uint32 needed = size + BLOCK_OVERHEAD + HEAP_ARENA_OVERHEAD;
+    uint32 bytes = heap_stats.total_size / 2;
+    
+    if (bytes > (PMM_BLOCK_SIZE << PMM_MAX_ORDER)) {
+        bytes = PMM_BLOCK_SIZE << PMM_MAX_ORDER;
+    }
+    if (bytes < HEAP_GROW_SIZE) {
+        bytes = HEAP_GROW_SIZE;
+    }
+    if (bytes < needed) {
+        bytes = needed;
+    }
+    
+    if (heap_add_arena(align_up(bytes, PMM_BLOCK_SIZE) / PMM_BLOCK_SIZE)) {
+        return 1;
+    }
+    return bytes > needed && heap_add_arena(align_up(needed, PMM_BLOCK_SIZE) / PMM_BLOCK_SIZE) != 0;
+}
+
+static void heap_trim(memory_block_t* block) {
+    int index = heap_find_arena((uintptr)block);
+    if (index <= 0) {
+        return;
+    }
+    
+    heap_arena_t* arena = &heap_arenas[index];
+    uintptr first = arena->start + sizeof(memory_footer_t);
+    
+    if ((uintptr)block == first) {
+        free_list_remove(block);
+        block->magic = 0;
+        pmm_free_pages(arena->start, (arena->end - arena->start) / PMM_BLOCK_SIZE);
+        
+        heap_stats.total_size -= arena->end - arena->start;
+        heap_stats.free_size -= arena->end - arena->start;
+        heap_stats.num_blocks--;
+        
+        num_arenas--;
+        heap_arenas[index] = heap_arenas[num_arenas];
+        return;
+    }
+    
+    uintptr keep = (uintptr)block + BLOCK_OVERHEAD + MIN_ALLOC_SIZE + sizeof(memory_block_t);
+    uintptr new_end = align_up(keep, PMM_BLOCK_SIZE);
+    
+    if (arena->end - new_end < HEAP_TRIM_THRESHOLD) {
+        return;
+    }
+    
+    free_list_remove(block);
+    block->size = new_end - (uintptr)block - BLOCK_OVERHEAD - sizeof(memory_block_t);
+    write_footer(block);
+    write_epilogue(new_end);
+    free_list_insert(block);
+    pmm_free_pages(new_end, (arena->end - new_end) / PMM_BLOCK_SIZE);
+    
+    heap_stats.total_size -= arena->end - new_end;
+    heap_stats.free_size -= arena->end - new_end;
+    arena->end = new_end;
+}
+
 void init_memory() {
-    heap_start = (memory_block_t*)HEAP_START;
-    heap_start->magic = HEAP_MAGIC;
-    heap_start->size = HEAP_SIZE - sizeof(memory_block_t);
-    heap_start->is_free = 1;
-    heap_start->next = 0;
-    heap_start->prev = 0;
-    
-    heap_stats.total_size = HEAP_SIZE;
+    num_arenas = 0;
+    free_list = 0;
+    
+    heap_stats.total_size = 0;
     heap_stats.used_size = 0;
-    heap_stats.free_size = HEAP_SIZE;
-    heap_stats.num_blocks = 1;
+    heap_stats.free_size = 0;
+    heap_stats.num_blocks = 0;
     heap_stats.num_allocs = 0;
     heap_stats.num_frees = 0;
     heap_stats.num_coalesces = 0;
+    heap_stats.num_free_blocks = 0;
+    heap_stats.largest_free = 0;
+    memset(heap_stats.free_bins, 0, sizeof(heap_stats.free_bins));
+    largest_free_stale = 0;
+    
+    heap_add_arena(HEAP_INITIAL_SIZE / PMM_BLOCK_SIZE);
+    heap_initialized = 1;
+    
+    init_slab();
+}
+
+static int heap_contains(void* ptr) {
+    return heap_find_arena((uintptr)ptr) >= 0;
 }
 
 static memory_block_t* find_block_first_fit(uint32 size) {
-    memory_block_t* current = heap_start;
+    memory_block_t* current = free_list;
     
     while (current) {
-        if (current->is_free && current->size >= size && current->magic == HEAP_MAGIC) {
+        if (current->size >= size) {
             return current;
         }
         current = current->next;
@@ -62,15 +289,16 @@ static memory_block_t* find_block_first_fit(uint32 size) {
 }
 
 static memory_block_t* find_block_best_fit(uint32 size) {
-    memory_block_t* current = heap_start;
+    memory_block_t* current = free_list;
     memory_block_t* best = 0;
     uint32 best_size = 0xFFFFFFFF;
     
     while (current) {
-        if (current->is_free && current->size >= size && current->magic == HEAP_MAGIC) {
-            if (current->size < best_size) {
-                best = current;
-                best_size = current->size;
+        if (current->size >= size && current->size < best_size) {
+            best = current;
+            best_size = current->size;
+            if (best_size == size) {
+                break;
             }
         }
         current = current->next;
@@ -80,16 +308,14 @@ static memory_block_t* find_block_best_fit(uint32 size) {
 }
 
 static memory_block_t* find_block_worst_fit(uint32 size) {
-    memory_block_t* current = heap_start;
+    memory_block_t* current = free_list;
     memory_block_t* worst = 0;
     uint32 worst_size = 0;
     
     while (current) {
-        if (current->is_free && current->size >= size && current->magic == HEAP_MAGIC) {
-            if (current->size > worst_size) {
-                worst = current;
-                worst_size = current->size;
-            }
+        if (current->size >= size && current->size > worst_size) {
+            worst = current;
+            worst_size = current->size;
         }
         current = current->next;
     }
@@ -111,55 +337,166 @@ static memory_block_t* find_block(uint32 size) {
 }
 
 static void split_block(memory_block_t* block, uint32 size) {
-    if (block->size > size + sizeof(memory_block_t) + MIN_ALLOC_SIZE) {
-        memory_block_t* new_block = (memory_block_t*)((uintptr)block + sizeof(memory_block_t) + size);
+    if (block->size >= size + BLOCK_OVERHEAD + MIN_ALLOC_SIZE) {
+        memory_block_t* new_block = (memory_block_t*)((uintptr)block + BLOCK_OVERHEAD + size);
         new_block->magic = HEAP_MAGIC;
-        new_block->size = block->size - size - sizeof(memory_block_t);
+        new_block->size = block->size - size - BLOCK_OVERHEAD;
         new_block->is_free = 1;
-        new_block->next = block->next;
-        new_block->prev = block;
-        
-        if (block->next) {
-            block->next->prev = new_block;
-        }
+        write_footer(new_block);
+        free_list_insert(new_block);
         
         block->size = size;
-        block->next = new_block;
+        write_footer(block);
         
         heap_stats.num_blocks++;
     }
 }
 
-void* kmalloc(size_t size) {
-    if (!heap_start) {
-        init_memory();
+static void* heap_use_block(memory_block_t* block, uint32 size) {
+    split_block(block, size);
+    
+    block->is_free = 0;
+    write_footer(block);
+    used_memory += block->size + BLOCK_OVERHEAD;
+    
+    heap_stats.used_size += block->size + BLOCK_OVERHEAD;
+    heap_stats.free_size -= block->size + BLOCK_OVERHEAD;
+    heap_stats.num_allocs++;
+    
+    return (void*)((uintptr)block + sizeof(memory_block_t));
+}
+
+static void* heap_alloc(size_t size) {
+    size = align_up(size, ALIGNMENT);
+    
+    memory_block_t* block = find_block(size);
+    
+    if (!block) {
+        if (!heap_grow(size)) {
+            return 0;
+        }
+        block = find_block(size);
+        if (!block) {
+            return 0;
+        }
     }
     
-    if (size == 0) {
-        return 0;
+    free_list_remove(block);
+    return heap_use_block(block, size);
+}
+
+static uintptr aligned_payload(memory_block_t* block, uintptr alignment) {
+    uintptr payload = (uintptr)block + sizeof(memory_block_t);
+    uintptr aligned = align_up(payload, alignment);
+    
+    if (aligned != payload && aligned - payload < BLOCK_OVERHEAD + MIN_ALLOC_SIZE) {
+        aligned = align_up(payload + BLOCK_OVERHEAD + MIN_ALLOC_SIZE, alignment);
+    }
+    
+    return aligned;
+}
+
+static memory_block_t* find_block_aligned(uint32 size, uintptr alignment) {
+    memory_block_t* current = free_list;
+    
+    while (current) {
+        uintptr end = (uintptr)current + sizeof(memory_block_t) + current->size;
+        if (aligned_payload(current, alignment) + size <= end) {
+            return current;
+        }
+        current = current->next;
     }
     
+    return 0;
+}
+
+static void* heap_alloc_aligned(size_t size, size_t alignment) {
     size = align_up(size, ALIGNMENT);
     
-    memory_block_t* block = find_block(size);
+    memory_block_t* block = find_block_aligned(size, alignment);
     
     if (!block) {
+        if (!heap_grow(size + alignment + BLOCK_OVERHEAD + MIN_ALLOC_SIZE)) {
+            return 0;
+        }
+        block = find_block_aligned(size, alignment);
+        if (!block) {
+            return 0;
+        }
+    }
+    
+    free_list_remove(block);
+    
+    uintptr aligned = aligned_payload(block, alignment);
+    if (aligned != (uintptr)block + sizeof(memory_block_t)) {
+        memory_block_t* lead = block;
+        uintptr end = (uintptr)lead + sizeof(memory_block_t) + lead->size;
+        
+        block = (memory_block_t*)(aligned - sizeof(memory_block_t));
+        block->magic = HEAP_MAGIC;
+        block->size = end - aligned;
+        block->is_free = 1;
+        
+        lead->size = (uintptr)block - (uintptr)lead - BLOCK_OVERHEAD;
+        write_footer(lead);
+        free_list_insert(lead);
+        
+        heap_stats.num_blocks++;
+    }
+    
+    return heap_use_block(block, size);
+}
+
+static uint32 page_alloc_slot(uintptr addr) {
+    return (addr / PMM_BLOCK_SIZE) & (PAGE_ALLOC_SLOTS - 1);
+}
+
+static void* page_alloc(size_t size) {
+    uint32 pages = align_up(size, PMM_BLOCK_SIZE) / PMM_BLOCK_SIZE;
+    uintptr addr = pmm_allocate_pages(pages);
+    
+    if (addr == 0) {
         return 0;
     }
     
-    split_block(block, size);
+    uint32 slot = page_alloc_slot(addr);
+    for (uint32 i = 0; i < PAGE_ALLOC_SLOTS; i++) {
+        page_alloc_t* entry = &page_allocs[(slot + i) & (PAGE_ALLOC_SLOTS - 1)];
+        if (entry->addr == 0 || entry->addr == PAGE_ALLOC_TOMBSTONE) {
+            entry->addr = addr;
+            entry->pages = pages;
+            heap_stats.num_allocs++;
+            return (void*)addr;
+        }
+    }
     
-    block->is_free = 0;
-    used_memory += block->size + sizeof(memory_block_t);
+    pmm_free_pages(addr, pages);
+    return 0;
+}
+
+static page_alloc_t* page_alloc_find(void* ptr) {
+    uintptr addr = (uintptr)ptr;
     
-    heap_stats.used_size += block->size + sizeof(memory_block_t);
-    heap_stats.free_size -= block->size + sizeof(memory_block_t);
-    heap_stats.num_allocs++;
+    if (addr & (PMM_BLOCK_SIZE - 1)) {
+        return 0;
+    }
     
-    return (void*)((uintptr)block + sizeof(memory_block_t));
+    uint32 slot = page_alloc_slot(addr);
+    for (uint32 i = 0; i < PAGE_ALLOC_SLOTS; i++) {
+        page_alloc_t* entry = &page_allocs[(slot + i) & (PAGE_ALLOC_SLOTS - 1)];
+        if (entry->addr == addr) {
+            return entry;
+        }
+        if (entry->addr == 0) {
+            return 0;
+        }
+    }
+    
+    return 0;
 }
-void* kmalloc_a(size_t size, size_t alignment) {
-    if (!heap_start) {
+
+static void* kmalloc_internal(size_t size) {
+    if (!heap_initialized) {
         init_memory();
     }
     
@@ -167,88 +504,222 @@ void* kmalloc_a(size_t size, size_t alignment) {
         return 0;
     }
     
-    size = align_up(size, ALIGNMENT);
-    uint32 aligned_size = size + alignment + sizeof(memory_block_t);
+    if (size <= SLAB_MAX_SIZE) {
+        void* ptr = slab_alloc(size);
+        if (ptr) {
+            heap_stats.num_allocs++;
+            return ptr;
+        }
+    }
     
-    void* ptr = kmalloc(aligned_size);
-    if (!ptr) {
+    return heap_alloc(size);
+}
+
+static void* kmalloc_a_internal(size_t size, size_t alignment) {
+    if (!heap_initialized) {
+        init_memory();
+    }
+    
+    if (size == 0 || (alignment & (alignment - 1))) {
         return 0;
     }
     
-    uintptr addr = (uintptr)ptr;
-    uintptr aligned_addr = align_up(addr, alignment);
+    if (alignment <= ALIGNMENT) {
+        return kmalloc_internal(size);
+    }
     
-    return (void*)aligned_addr;
+    if (alignment == PMM_BLOCK_SIZE) {
+        void* ptr = page_alloc(size);
+        if (ptr) {
+            return ptr;
+        }
+    }
+    
+    if (size <= SLAB_MAX_SIZE && alignment <= SLAB_MAX_SIZE) {
+        void* ptr = slab_alloc(size < alignment ? alignment : size);
+        if (ptr) {
+            heap_stats.num_allocs++;
+            return ptr;
+        }
+    }
+    
+    return heap_alloc_aligned(size, alignment);
+}
+
+static uint32 allocation_size(void* ptr) {
+    if (heap_contains(ptr)) {
+        memory_block_t* block = (memory_block_t*)((uintptr)ptr - sizeof(memory_block_t));
+        
+        if (block->magic != HEAP_MAGIC || block->is_free) {
+            return 0;
+        }
+        return block->size;
+    }
+    
+    page_alloc_t* entry = page_alloc_find(ptr);
+    if (entry) {
+        return entry->pages * PMM_BLOCK_SIZE;
+    }
+    
+    return slab_object_size(ptr);
 }
 
 void* kcalloc(size_t num, size_t size) {
     size_t total_size = num * size;
-    void* ptr = kmalloc(total_size);
+    uint64 flags = spin_lock_irqsave(&heap_lock);
+    void* ptr = kmalloc_internal(total_size);
     
     if (ptr) {
         memset(ptr, 0, total_size);
+        heapprof_record_alloc(ptr, total_size, (uintptr)__builtin_return_address(0));
     }
     
+    spin_unlock_irqrestore(&heap_lock, flags);
     return ptr;
 }
 
-void* krealloc(void* ptr, size_t size) {
+static memory_block_t* coalesce_block(memory_block_t* block);
+static void kfree_internal(void* ptr);
+
+static void heap_shrink_block(memory_block_t* block, uint32 size) {
+    if (block->size < size + BLOCK_OVERHEAD + MIN_ALLOC_SIZE) {
+        return;
+    }
+    
+    memory_block_t* tail = (memory_block_t*)((uintptr)block + BLOCK_OVERHEAD + size);
+    tail->magic = HEAP_MAGIC;
+    tail->size = block->size - size - BLOCK_OVERHEAD;
+    tail->is_free = 1;
+    
+    block->size = size;
+    write_footer(block);
+    
+    used_memory -= tail->size + BLOCK_OVERHEAD;
+    heap_stats.used_size -= tail->size + BLOCK_OVERHEAD;
+    heap_stats.free_size += tail->size + BLOCK_OVERHEAD;
+    heap_stats.num_blocks++;
+    
+    tail = coalesce_block(tail);
+    free_list_insert(tail);
+    
+    if (is_epilogue(next_block(tail))) {
+        heap_trim(tail);
+    }
+}
+
+static int heap_resize(memory_block_t* block, size_t size) {
+    size = align_up(size, ALIGNMENT);
+    
+    if (size > block->size) {
+        memory_block_t* next = next_block(block);
+        
+        if (!next->is_free || next->magic != HEAP_MAGIC ||
+            block->size + BLOCK_OVERHEAD + next->size < size) {
+            return 0;
+        }
+        
+        free_list_remove(next);
+        block->size += BLOCK_OVERHEAD + next->size;
+        next->magic = 0;
+        write_footer(block);
+        
+        used_memory += next->size + BLOCK_OVERHEAD;
+        heap_stats.used_size += next->size + BLOCK_OVERHEAD;
+        heap_stats.free_size -= next->size + BLOCK_OVERHEAD;
+        heap_stats.num_blocks--;
+    }
+    
+    heap_shrink_block(block, size);
+    return 1;
+}
+
+static int page_resize(page_alloc_t* entry, size_t size) {
+    uint32 pages = align_up(size, PMM_BLOCK_SIZE) / PMM_BLOCK_SIZE;
+    
+    if (pages > entry->pages) {
+        return 0;
+    }
+    
+    if (pages < entry->pages) {
+        pmm_free_pages(entry->addr + pages * PMM_BLOCK_SIZE, entry->pages - pages);
+        entry->pages = pages;
+    }
+    
+    return 1;
+}
+
+static void* krealloc_internal(void* ptr, size_t size) {
     if (!ptr) {
-        return kmalloc(size);
+        return kmalloc_internal(size);
     }
     
     if (size == 0) {
-        kfree(ptr);
+        kfree_internal(ptr);
         return 0;
     }
     
-    memory_block_t* block = (memory_block_t*)((uintptr)ptr - sizeof(memory_block_t));
+    if (heap_contains(ptr)) {
+        memory_block_t* block = (memory_block_t*)((uintptr)ptr - sizeof(memory_block_t));
+        
+        if (block->magic != HEAP_MAGIC || block->is_free) {
+            return 0;
+        }
+        
+        if (heap_resize(block, size)) {
+            return ptr;
+        }
+    } else {
+        page_alloc_t* entry = page_alloc_find(ptr);
+        if (entry && page_resize(entry, size)) {
+            return ptr;
+        }
+    }
     
-    if (block->magic != HEAP_MAGIC) {
+    uint32 old_size = allocation_size(ptr);
+    if (old_size == 0) {
         return 0;
     }
     
-    if (block->size >= size) {
+    if (old_size >= size) {
         return ptr;
     }
     
-    void* new_ptr = kmalloc(size);
+    void* new_ptr = kmalloc_internal(size);
     if (!new_ptr) {
         return 0;
     }
     
-    memcpy(new_ptr, ptr, block->size);
-    kfree(ptr);
+    memcpy(new_ptr, ptr, old_size);
+    kfree_internal(ptr);
     
     return new_ptr;
 }
 
-static void coalesce_blocks() {
-    memory_block_t* current = heap_start;
+static memory_block_t* coalesce_block(memory_block_t* block) {
+    memory_block_t* next = next_block(block);
+    if (next->is_free && next->magic == HEAP_MAGIC) {
+        free_list_remove(next);
+        block->size += BLOCK_OVERHEAD + next->size;
+        next->magic = 0;
+        heap_stats.num_blocks--;
+        heap_stats.num_coalesces++;
+    }
     
-    while (current && current->next) {
-        if (current->is_free && current->next->is_free && 
-            current->magic == HEAP_MAGIC && current->next->magic == HEAP_MAGIC) {
-            current->size += sizeof(memory_block_t) + current->next->size;
-            current->next = current->next->next;
-            
-            if (current->next) {
-                current->next->prev = current;
-            }
-            
-            heap_stats.num_blocks--;
-            heap_stats.num_coalesces++;
-        } else {
-            current = current->next;
-        }
+    memory_block_t* prev = prev_block(block);
+    if (prev && prev->is_free && prev->magic == HEAP_MAGIC) {
+        free_list_remove(prev);
+        prev->size += BLOCK_OVERHEAD + block->size;
+        block->magic = 0;
+        block = prev;
+        heap_stats.num_blocks--;
+        heap_stats.num_coalesces++;
     }
+    
+    write_footer(block);
+    return block;
 }
 
-void kfree(void* ptr) {
-    if (!ptr) {
-        return;
-    }
-    
+static void heap_free(void* ptr) {
     memory_block_t* block = (memory_block_t*)((uintptr)ptr - sizeof(memory_block_t));
     
     if (block->magic != HEAP_MAGIC) {
@@ -260,13 +731,75 @@ void kfree(void* ptr) {
     }
     
     block->is_free = 1;
-    used_memory -= block->size + sizeof(memory_block_t);
+    used_memory -= block->size + BLOCK_OVERHEAD;
     
-    heap_stats.used_size -= block->size + sizeof(memory_block_t);
-    heap_stats.free_size += block->size + sizeof(memory_block_t);
+    heap_stats.used_size -= block->size + BLOCK_OVERHEAD;
+    heap_stats.free_size += block->size + BLOCK_OVERHEAD;
     heap_stats.num_frees++;
     
-    coalesce_blocks();
+    block = coalesce_block(block);
+    free_list_insert(block);
+    
+    if (is_epilogue(next_block(block))) {
+        heap_trim(block);
+    }
+}
+
+static void kfree_internal(void* ptr) {
+    if (!ptr) {
+        return;
+    }
+    
+    if (heap_contains(ptr)) {
+        heap_free(ptr);
+        return;
+    }
+    
+    page_alloc_t* entry = page_alloc_find(ptr);
+    if (entry) {
+        pmm_free_pages(entry->addr, entry->pages);
+        entry->addr = PAGE_ALLOC_TOMBSTONE;
+        entry->pages = 0;
+        heap_stats.num_frees++;
+    } else if (slab_free(ptr)) {
+        heap_stats.num_frees++;
+    }
+}
+
+void* kmalloc(size_t size) {
+    uint64 flags = spin_lock_irqsave(&heap_lock);
+    void* ptr = kmalloc_internal(size);
+    heapprof_record_alloc(ptr, size, (uintptr)__builtin_return_address(0));
+    spin_unlock_irqrestore(&heap_lock, flags);
+    return ptr;
+}
+
+void* kmalloc_a(size_t size, size_t alignment) {
+    uint64 flags = spin_lock_irqsave(&heap_lock);
+    void* ptr = kmalloc_a_internal(size, alignment);
+    heapprof_record_alloc(ptr, size, (uintptr)__builtin_return_address(0));
+    spin_unlock_irqrestore(&heap_lock, flags);
+    return ptr;
+}
+
+void* krealloc(void* ptr, size_t size) {
+    uint64 flags = spin_lock_irqsave(&heap_lock);
+    void* new_ptr = krealloc_internal(ptr, size);
+    
+    if (new_ptr != ptr && (new_ptr || size == 0)) {
+        heapprof_record_free(ptr);
+        heapprof_record_alloc(new_ptr, size, (uintptr)__builtin_return_address(0));
+    }
+    
+    spin_unlock_irqrestore(&heap_lock, flags);
+    return new_ptr;
+}
+
+void kfree(void* ptr) {
+    uint64 flags = spin_lock_irqsave(&heap_lock);
+    heapprof_record_free(ptr);
+    kfree_internal(ptr);
+    spin_unlock_irqrestore(&heap_lock, flags);
 }
 
 void set_alloc_strategy(alloc_strategy_t strategy) {
@@ -310,12 +843,37 @@ void print_memory_stats() {
     int_to_ascii(heap_stats.num_coalesces, coal_str);
     printf(coal_str);
     printf("\n");
+    
+    printf("Free Blocks: ");
+    char blocks_str[20];
+    int_to_ascii(heap_stats.num_free_blocks, blocks_str);
+    printf(blocks_str);
+    printf("\n");
+    
+    printf("Largest Free Block: ");
+    char largest_str[20];
+    int_to_ascii(get_largest_free_block(), largest_str);
+    printf(largest_str);
+    printf(" bytes\n");
+    
+    printf("Fragmentation: ");
+    char frag_str[20];
+    int_to_ascii(get_heap_fragmentation(), frag_str);
+    printf(frag_str);
+    printf("%\n");
+    
+    slab_print_stats();
 }
 
 void print_heap_blocks() {
-    memory_block_t* current = heap_start;
+    uint32 arena = 0;
+    memory_block_t* current = 0;
     int block_num = 0;
     
+    if (num_arenas > 0) {
+        current = (memory_block_t*)(heap_arenas[0].start + sizeof(memory_footer_t));
+    }
+    
     printf("Heap Blocks:\n");
     while (current && block_num < 20) {
         printf("Block ");
@@ -335,11 +893,159 @@ void print_heap_blocks() {
             printf("USED\n");
         }
         
-        current = current->next;
+        current = next_block(current);
+        if (is_epilogue(current)) {
+            arena++;
+            current = 0;
+            if (arena < num_arenas) {
+                current = (memory_block_t*)(heap_arenas[arena].start + sizeof(memory_footer_t));
+            }
+        }
         block_num++;
     }
 }
 
+uint32 get_largest_free_block() {
+    if (largest_free_stale) {
+        uint32 largest = 0;
+        int top = HEAP_FREE_BINS - 1;
+        
+        while (top >= 0 && heap_stats.free_bins[top] == 0) {
+            top--;
+        }
+        
+        if (top >= 0) {
+            uint32 remaining = heap_stats.free_bins[top];
+            memory_block_t* current = free_list;
+            
+            while (current && remaining > 0) {
+                if (free_bin(current->size) == (uint32)top) {
+                    if (current->size > largest) {
+                        largest = current->size;
+                    }
+                    remaining--;
+                }
+                current = current->next;
+            }
+        }
+        
+        heap_stats.largest_free = largest;
+        largest_free_stale = 0;
+    }
+    
+    return heap_stats.largest_free;
+}
+
+uint32 get_heap_fragmentation() {
+    if (heap_stats.num_free_blocks <= 1 || heap_stats.free_size == 0) {
+        return 0;
+    }
+    
+    uint32 largest = get_largest_free_block() + BLOCK_OVERHEAD;
+    if (largest >= heap_stats.free_size) {
+        return 0;
+    }
+    
+    return 100 - (uint32)((uint64)largest * 100 / heap_stats.free_size);
+}
+
+int heap_can_allocate(uint32 size) {
+    uint32 bin = free_bin(align_up(size, ALIGNMENT));
+    
+    for (uint32 i = bin + 1; i < HEAP_FREE_BINS; i++) {
+        if (heap_stats.free_bins[i]) {
+            return 1;
+        }
+    }
+    
+    return get_largest_free_block() >= size;
+}
+
+static void print_map_cell(uint32 used, uint32 free, int* column, uintptr address) {
+    if (*column == 0) {
+        char addr_str[10];
+        printf("  ");
+        uint_to_hex((uint32)address, addr_str);
+        printf(addr_str);
+        printf(" ");
+    }
+    
+    if (free == 0) {
+        printfch('#');
+    } else if (used == 0) {
+        printfch('.');
+    } else {
+        printfch('+');
+    }
+    
+    (*column)++;
+    if (*column == HEAP_MAP_COLUMNS) {
+        printf("\n");
+        *column = 0;
+    }
+}
+
+static void print_arena_map(heap_arena_t* arena, uint32 chunk) {
+    uintptr chunk_start = arena->start;
+    uint32 used = sizeof(memory_footer_t);
+    uint32 free = 0;
+    int column = 0;
+    memory_block_t* block = (memory_block_t*)(arena->start + sizeof(memory_footer_t));
+    
+    while ((uintptr)block < arena->end) {
+        uintptr start = (uintptr)block;
+        uintptr end = is_epilogue(block) ? arena->end : (uintptr)next_block(block);
+        int block_free = block->is_free;
+        
+        while (start < end) {
+            uintptr chunk_end = chunk_start + chunk;
+            uintptr stop = end < chunk_end ? end : chunk_end;
+            
+            if (block_free) {
+                free += stop - start;
+            } else {
+                used += stop - start;
+            }
+            start = stop;
+            
+            if (start == chunk_end) {
+                print_map_cell(used, free, &column, chunk_start);
+                chunk_start = chunk_end;
+                used = 0;
+                free = 0;
+            }
+        }
+        
+        if (is_epilogue(block)) {
+            break;
+        }
+        block = next_block(block);
+    }
+    
+    if (used || free) {
+        print_map_cell(used, free, &column, chunk_start);
+    }
+    if (column != 0) {
+        printf("\n");
+    }
+}
+
+void print_heap_map(uint32 kib_per_char) {
+    if (kib_per_char == 0) {
+        kib_per_char = HEAP_MAP_DEFAULT_KIB;
+    }
+    
+    char num_str[20];
+    printf("Heap Map (");
+    int_to_ascii(kib_per_char, num_str);
+    printf(num_str);
+    printf(" KB/char, # used . free + mixed):\n");
+    
+    for (uint32 i = 0; i < num_arenas; i++) {
+        print_arena_map(&heap_arenas[i], kib_per_char * 1024);
+    }
+}
+
 uint32 get_free_memory() {
     return heap_stats.free_size;
 }
@@ -352,16 +1058,22 @@ heap_stats_t* get_heap_stats() {
     return &heap_stats;
 }
 
-void* kmalloc_p(size_t size, uint32* phys) {
-    void* ptr = kmalloc(size);
+void* kmalloc_p(size_t size, uintptr* phys) {
+    uint64 flags = spin_lock_irqsave(&heap_lock);
+    void* ptr = kmalloc_internal(size);
+    heapprof_record_alloc(ptr, size, (uintptr)__builtin_return_address(0));
+    spin_unlock_irqrestore(&heap_lock, flags);
     if (ptr && phys) {
         *phys = (uintptr)ptr;
     }
     return ptr;
 }
 
-void* kmalloc_ap(size_t size, size_t alignment, uint32* phys) {
-    void* ptr = kmalloc_a(size, alignment);
+void* kmalloc_ap(size_t size, size_t alignment, uintptr* phys) {
+    uint64 flags = spin_lock_irqsave(&heap_lock);
+    void* ptr = kmalloc_a_internal(size, alignment);
+    heapprof_record_alloc(ptr, size, (uintptr)__builtin_return_address(0));
+    spin_unlock_irqrestore(&heap_lock, flags);
     if (ptr && phys) {
         *phys = (uintptr)ptr;
     }
@@ -21,15 +21,65 @@
 #include "../include/screen.h"
 #include "../include/string.h"
 #include "../include/idt.h"
+#include "../include/pmm.h"
+#include "../include/system.h"
+#include "../include/vspace.h"
+#include "../include/smp.h"
+#include "../include/spinlock.h"
 
-static page_directory_struct_t* kernel_directory = 0;
-static page_directory_struct_t* current_directory = 0;
+#define VALLOC_BASE 0xFFFFC00000000000ULL
+#define VALLOC_SIZE 0x10000000000ULL
+
+extern void page_fault_entry();
 
-extern uint32 pmm_allocate_page();
-extern void pmm_free_page(uint32 page);
+typedef struct tlb_batch {
+    page_directory_struct_t* dir;
+    uint64 addrs[TLB_FLUSH_THRESHOLD];
+    uint64 frames[TLB_BATCH_FRAMES];
+    uint32 count;
+    uint32 frame_count;
+    int global;
+} tlb_batch_t;
+
+static page_directory_struct_t* kernel_directory = 0;
 
 static page_directory_struct_t kernel_dir_struct;
 static int paging_initialized = 0;
+static int huge_1g_supported = 0;
+static int pcid_enabled = 0;
+static volatile uint64 tlb_gen_next = 0;
+static vspace_t kernel_vspace;
+static spinlock_t paging_lock = SPINLOCK_INIT;
+static tlb_batch_t* volatile shootdown_batch = 0;
+static volatile uint32 shootdown_pending = 0;
+
+static inline page_table_t* table_of(page_t entry) {
+    return (page_table_t*)PHYS_TO_VIRT(entry & PAGE_FRAME);
+}
+
+static page_table_t* alloc_table(uint64* phys) {
+    *phys = pmm_allocate_page_flags(PMM_ALLOC_ZERO);
+    if (!*phys) {
+        return 0;
+    }
+    return (page_table_t*)PHYS_TO_VIRT(*phys);
+}
+
+static void release_table(page_table_t* table, uint32 shift) {
+    if (shift > PT_SHIFT) {
+        for (uint32 i = 0; i < PAGE_ENTRIES; i++) {
+            page_t entry = table->entries[i];
+            if ((entry & PAGE_PRESENT) && !(entry & PAGE_HUGE)) {
+                release_table(table_of(entry), shift - 9);
+            }
+        }
+    }
+    pmm_free_page((uintptr)table);
+}
+
+static void tlb_gen_bump(page_directory_struct_t* dir) {
+    dir->tlb_gen = __sync_add_and_fetch(&tlb_gen_next, 1);
+}
 
 static page_directory_struct_t* create_page_directory() {
     page_directory_struct_t* dir;
@@ -44,151 +94,696 @@ static page_directory_struct_t* create_page_directory() {
         }
     }
     
-    memset(dir->directory, 0, sizeof(page_directory_t));
-    memset(dir->tables, 0, sizeof(page_table_t*) * PAGES_PER_DIR);
-    memset(dir->physical_tables, 0, sizeof(uint32) * PAGES_PER_DIR);
-    
-    dir->physical_addr = (uintptr)dir->directory;
+    tlb_gen_bump(dir);
+    dir->vmas = 0;
+    dir->pml4 = alloc_table(&dir->physical_addr);
+    if (!dir->pml4) {
+        if (dir != &kernel_dir_struct) {
+            kfree(dir);
+        }
+        return 0;
+    }
     
     return dir;
 }
 
-void identity_map(uint32 start, uint32 end) {
-    uint32 addr;
-    for (addr = start; addr < end; addr += PAGE_SIZE) {
-        map_page(addr, addr, PAGE_PRESENT | PAGE_WRITE);
+static void tlb_batch_init(tlb_batch_t* batch, page_directory_struct_t* dir) {
+    batch->dir = dir;
+    batch->count = 0;
+    batch->frame_count = 0;
+    batch->global = 0;
+}
+
+static void tlb_flush_local(tlb_batch_t* batch) {
+    int current = batch->dir == get_current_directory();
+    
+    if (batch->count > TLB_FLUSH_THRESHOLD) {
+        if (batch->global) {
+            flush_tlb_all();
+        } else if (current) {
+            flush_tlb();
+        }
+    } else if (current || batch->global) {
+        for (uint32 i = 0; i < batch->count; i++) {
+            flush_tlb_entry(batch->addrs[i]);
+        }
     }
 }
 
-void map_kernel_space() {
-    identity_map(0x0, 0x800000);
+void tlb_shootdown_service() {
+    uint32 bit = 1u << smp_this_cpu()->id;
+    
+    if (shootdown_pending & bit) {
+        tlb_flush_local(shootdown_batch);
+        __sync_fetch_and_and(&shootdown_pending, ~bit);
+    }
 }
 
-void map_page(uint32 virtual_addr, uint32 physical_addr, uint32 flags) {
-    uint32 page_dir_idx = virtual_addr / (PAGE_SIZE * PAGES_PER_TABLE);
-    uint32 page_table_idx = (virtual_addr / PAGE_SIZE) % PAGES_PER_TABLE;
+static uint64 paging_lock_irqsave() {
+    uint64 flags = irq_save();
     
-    if (!current_directory->tables[page_dir_idx]) {
-        uint32 phys = pmm_allocate_page();
-        current_directory->tables[page_dir_idx] = (page_table_t*)(uintptr)phys;
-        current_directory->physical_tables[page_dir_idx] = phys | PAGE_PRESENT | PAGE_WRITE | (flags & PAGE_USER);
-        current_directory->directory[page_dir_idx] = phys | PAGE_PRESENT | PAGE_WRITE | (flags & PAGE_USER);
-        
-        memset((void*)(uintptr)phys, 0, PAGE_SIZE);
+    while (!spin_trylock(&paging_lock)) {
+        tlb_shootdown_service();
+        __asm__ __volatile__("pause");
     }
     
-    page_table_t* table = current_directory->tables[page_dir_idx];
-    (*table)[page_table_idx] = (physical_addr & PAGE_FRAME) | flags;
+    return flags;
+}
+
+static void tlb_shootdown(tlb_batch_t* batch) {
+    uint32 self = smp_this_cpu()->id;
+    uint32 online = smp_online_mask();
+    uint32 targets = 0;
     
-    flush_tlb_entry(virtual_addr);
+    for (uint32 id = 0; id < MAX_CPUS; id++) {
+        if (id != self && (online & (1u << id)) &&
+            (batch->global || smp_get_cpu(id)->page_directory == batch->dir)) {
+            targets |= 1u << id;
+        }
+    }
+    
+    if (!targets) {
+        return;
+    }
+    
+    shootdown_batch = batch;
+    __sync_synchronize();
+    shootdown_pending = targets;
+    smp_send_ipi(targets, TLB_SHOOTDOWN_VECTOR);
+    
+    while (shootdown_pending) {
+        __asm__ __volatile__("pause");
+    }
 }
 
-void unmap_page(uint32 virtual_addr) {
-    uint32 page_dir_idx = virtual_addr / (PAGE_SIZE * PAGES_PER_TABLE);
-    uint32 page_table_idx = (virtual_addr / PAGE_SIZE) % PAGES_PER_TABLE;
+static void tlb_batch_flush(tlb_batch_t* batch) {
+    if (batch->count > 0) {
+        tlb_gen_bump(batch->dir);
+        tlb_flush_local(batch);
+        tlb_shootdown(batch);
+    }
     
-    if (!current_directory->tables[page_dir_idx]) {
+    for (uint32 i = 0; i < batch->frame_count; i++) {
+        pmm_unref_page(batch->frames[i]);
+    }
+    
+    batch->count = 0;
+    batch->frame_count = 0;
+    batch->global = 0;
+}
+
+static void tlb_batch_add(tlb_batch_t* batch, uint64 virtual_addr, page_t old_entry, uint64 frame) {
+    if (!(old_entry & PAGE_PRESENT)) {
         return;
     }
     
-    page_table_t* table = current_directory->tables[page_dir_idx];
-    (*table)[page_table_idx] = 0;
+    if (old_entry & PAGE_GLOBAL) {
+        batch->global = 1;
+    }
+    if (batch->count < TLB_FLUSH_THRESHOLD) {
+        batch->addrs[batch->count] = virtual_addr;
+    }
+    batch->count++;
     
-    flush_tlb_entry(virtual_addr);
+    if (frame) {
+        batch->frames[batch->frame_count++] = frame;
+        if (batch->frame_count == TLB_BATCH_FRAMES) {
+            tlb_batch_flush(batch);
+        }
+    }
 }
 
-uint32 get_physical_address(uint32 virtual_addr) {
-    uint32 page_dir_idx = virtual_addr / (PAGE_SIZE * PAGES_PER_TABLE);
-    uint32 page_table_idx = (virtual_addr / PAGE_SIZE) % PAGES_PER_TABLE;
+static void invalidate_page(page_directory_struct_t* dir, uint64 virtual_addr, page_t old_entry) {
+    tlb_batch_t batch;
+    tlb_batch_init(&batch, dir);
+    tlb_batch_add(&batch, virtual_addr, old_entry, 0);
+    tlb_batch_flush(&batch);
+}
+
+static void invalidate_all(page_directory_struct_t* dir, int global) {
+    tlb_batch_t batch;
+    tlb_batch_init(&batch, dir);
+    batch.count = TLB_FLUSH_THRESHOLD + 1;
+    batch.global = global;
+    tlb_batch_flush(&batch);
+}
+
+static uint64 pcid_assign(cpu_t* cpu, page_directory_struct_t* dir) {
+    uint64 gen = dir->tlb_gen;
+    uint32 pcid = PCID_NONE;
     
-    if (!current_directory->tables[page_dir_idx]) {
-        return 0;
+    if (dir != kernel_directory) {
+        pcid = 1;
+        while (pcid < PCID_SLOTS && cpu->pcid_slots[pcid].dir != dir) {
+            pcid++;
+        }
+        
+        if (pcid == PCID_SLOTS) {
+            pcid = cpu->pcid_next + 1 < PCID_SLOTS ? cpu->pcid_next + 1 : 1;
+            cpu->pcid_next = pcid;
+        }
     }
     
-    page_table_t* table = current_directory->tables[page_dir_idx];
-    uint32 page_entry = (*table)[page_table_idx];
+    pcid_slot_t* slot = &cpu->pcid_slots[pcid];
+    int valid = slot->dir == dir && slot->tlb_gen == gen;
+    slot->dir = dir;
+    slot->tlb_gen = gen;
     
-    if (!(page_entry & PAGE_PRESENT)) {
-        return 0;
+    return pcid | (valid ? CR3_NOFLUSH : 0);
+}
+
+static int split_large_page(page_t* entry, uint32 shift) {
+    uint64 phys;
+    page_table_t* table = alloc_table(&phys);
+    if (!table) {
+        return -1;
+    }
+    
+    uint32 child_shift = shift - 9;
+    uint64 base = *entry & PAGE_FRAME & ~((1ULL << shift) - 1);
+    uint64 flags = *entry & PAGE_FLAGS_MASK & ~(uint64)PAGE_HUGE;
+    if (child_shift > PT_SHIFT) {
+        flags |= PAGE_HUGE;
     }
     
-    return (page_entry & PAGE_FRAME) + (virtual_addr & 0xFFF);
+    for (uint32 i = 0; i < PAGE_ENTRIES; i++) {
+        table->entries[i] = (base + ((uint64)i << child_shift)) | flags;
+    }
+    
+    *entry = phys | PAGE_PRESENT | PAGE_WRITE | (flags & PAGE_USER);
+    return 0;
 }
 
-void* get_page(uint32 virtual_addr, int make, page_directory_struct_t* dir) {
-    uint32 page_dir_idx = virtual_addr / (PAGE_SIZE * PAGES_PER_TABLE);
-    uint32 page_table_idx = (virtual_addr / PAGE_SIZE) % PAGES_PER_TABLE;
+static page_t* walk(page_directory_struct_t* dir, uint64 virtual_addr, uint32 target_shift, uint64 flags, int make) {
+    page_table_t* table = dir->pml4;
     
-    if (dir->tables[page_dir_idx]) {
-        page_table_t* table = dir->tables[page_dir_idx];
-        return (void*)&((*table)[page_table_idx]);
-    } else if (make) {
-        uint32 phys = pmm_allocate_page();
-        dir->tables[page_dir_idx] = (page_table_t*)(uintptr)phys;
-        dir->physical_tables[page_dir_idx] = phys | PAGE_PRESENT | PAGE_WRITE | PAGE_USER;
-        dir->directory[page_dir_idx] = phys | PAGE_PRESENT | PAGE_WRITE | PAGE_USER;
+    for (uint32 shift = PML4_SHIFT; shift > target_shift; shift -= 9) {
+        page_t* entry = &table->entries[PAGE_INDEX(virtual_addr, shift)];
+        
+        if (!(*entry & PAGE_PRESENT)) {
+            if (!make) {
+                return 0;
+            }
+            uint64 phys;
+            if (!alloc_table(&phys)) {
+                return 0;
+            }
+            *entry = phys | PAGE_PRESENT | PAGE_WRITE | (flags & PAGE_USER);
+        } else if (*entry & PAGE_HUGE) {
+            page_t old_entry = *entry;
+            if (split_large_page(entry, shift) != 0) {
+                return 0;
+            }
+            invalidate_page(dir, virtual_addr, old_entry);
+        } else if (flags & PAGE_USER) {
+            *entry |= PAGE_USER;
+        }
         
-        memset((void*)(uintptr)phys, 0, PAGE_SIZE);
+        table = table_of(*entry);
+    }
+    
+    return &table->entries[PAGE_INDEX(virtual_addr, target_shift)];
+}
+
+int paging_supports_1g() {
+    return huge_1g_supported;
+}
+
+int paging_pcid_enabled() {
+    return pcid_enabled;
+}
+
+void identity_map(uint64 start, uint64 end) {
+    start &= PAGE_FRAME;
+    map_range(get_current_directory(), start, start, end - start, PAGE_KERNEL);
+}
+
+void map_kernel_space() {
+    identity_map(0x0, PMM_BOOT_MAPPED_LIMIT);
+    
+    uint32 count;
+    pmm_region_t* regions = pmm_get_regions(&count);
+    for (uint32 i = 0; i < count; i++) {
+        uint64 base = regions[i].base;
+        uint64 end = base + regions[i].size;
         
-        page_table_t* table = dir->tables[page_dir_idx];
-        return (void*)&((*table)[page_table_idx]);
+        if (end <= PMM_BOOT_MAPPED_LIMIT) {
+            continue;
+        }
+        if (base < PMM_BOOT_MAPPED_LIMIT) {
+            base = PMM_BOOT_MAPPED_LIMIT;
+        }
+        identity_map(base, end);
     }
+}
+
+static int map_page_size_locked(page_directory_struct_t* dir, uint64 virtual_addr, uint64 physical_addr, uint64 flags, uint64 page_size) {
+    uint32 shift = PT_SHIFT;
     
+    if (page_size == PAGE_SIZE_1G) {
+        if (!huge_1g_supported) {
+            return -1;
+        }
+        shift = PDPT_SHIFT;
+    } else if (page_size == PAGE_SIZE_2M) {
+        shift = PD_SHIFT;
+    } else if (page_size != PAGE_SIZE) {
+        return -1;
+    }
+    
+    if ((virtual_addr | physical_addr) & ((1ULL << shift) - 1)) {
+        return -1;
+    }
+    
+    page_t* entry = walk(dir, virtual_addr, shift, flags, 1);
+    if (!entry) {
+        return -1;
+    }
+    
+    if (shift > PT_SHIFT && (*entry & PAGE_PRESENT) && !(*entry & PAGE_HUGE)) {
+        page_table_t* old_table = table_of(*entry);
+        *entry = (physical_addr & PAGE_FRAME) | flags | PAGE_HUGE;
+        invalidate_all(dir, 1);
+        release_table(old_table, shift - 9);
+        return 0;
+    }
+    
+    page_t old_entry = *entry;
+    *entry = (physical_addr & PAGE_FRAME) | flags | (shift > PT_SHIFT ? PAGE_HUGE : 0);
+    
+    invalidate_page(dir, virtual_addr, old_entry);
     return 0;
 }
 
-void flush_tlb_entry(uint32 virtual_addr) {
+int map_page_size(page_directory_struct_t* dir, uint64 virtual_addr, uint64 physical_addr, uint64 flags, uint64 page_size) {
+    uint64 lock_flags = paging_lock_irqsave();
+    int result = map_page_size_locked(dir, virtual_addr, physical_addr, flags, page_size);
+    spin_unlock_irqrestore(&paging_lock, lock_flags);
+    return result;
+}
+
+static uint32 range_page_shift(uint64 virtual_addr, uint64 physical_addr, uint64 remaining) {
+    uint64 misalignment = virtual_addr | physical_addr;
+    
+    if (huge_1g_supported && !(misalignment & (PAGE_SIZE_1G - 1)) && remaining >= PAGE_SIZE_1G) {
+        return PDPT_SHIFT;
+    }
+    if (!(misalignment & (PAGE_SIZE_2M - 1)) && remaining >= PAGE_SIZE_2M) {
+        return PD_SHIFT;
+    }
+    return PT_SHIFT;
+}
+
+int map_range(page_directory_struct_t* dir, uint64 virtual_addr, uint64 physical_addr, uint64 size, uint64 flags) {
+    uint64 end = virtual_addr + ((size + PAGE_SIZE - 1) & PAGE_FRAME);
+    tlb_batch_t batch;
+    int result = 0;
+    
+    uint64 lock_flags = paging_lock_irqsave();
+    tlb_batch_init(&batch, dir);
+    
+    while (virtual_addr < end) {
+        uint32 shift = range_page_shift(virtual_addr, physical_addr, end - virtual_addr);
+        page_t* entry = walk(dir, virtual_addr, shift, flags, 1);
+        if (!entry) {
+            result = -1;
+            break;
+        }
+        
+        uint32 index = PAGE_INDEX(virtual_addr, shift);
+        uint64 huge = shift > PT_SHIFT ? PAGE_HUGE : 0;
+        
+        do {
+            page_t old_entry = *entry;
+            *entry = (physical_addr & PAGE_FRAME) | flags | huge;
+            
+            if (huge && (old_entry & PAGE_PRESENT) && !(old_entry & PAGE_HUGE)) {
+                invalidate_all(dir, 1);
+                release_table(table_of(old_entry), shift - 9);
+            } else {
+                tlb_batch_add(&batch, virtual_addr, old_entry, 0);
+            }
+            
+            virtual_addr += 1ULL << shift;
+            physical_addr += 1ULL << shift;
+            entry++;
+            index++;
+        } while (index < PAGE_ENTRIES && virtual_addr < end &&
+                 range_page_shift(virtual_addr, physical_addr, end - virtual_addr) == shift);
+    }
+    
+    tlb_batch_flush(&batch);
+    spin_unlock_irqrestore(&paging_lock, lock_flags);
+    return result;
+}
+
+static void unmap_level(tlb_batch_t* batch, page_table_t* table, uint32 shift, uint64 start, uint64 end, uint32 unmap_flags) {
+    uint64 size = 1ULL << shift;
+    uint64 addr = start;
+    
+    while (addr < end) {
+        uint64 next = (addr & ~(size - 1)) + size;
+        if (next > end || next < addr) {
+            next = end;
+        }
+        
+        page_t* entry = &table->entries[PAGE_INDEX(addr, shift)];
+        
+        if (*entry & PAGE_PRESENT) {
+            int leaf = shift == PT_SHIFT || (*entry & PAGE_HUGE);
+            
+            if (leaf && (addr & (size - 1) || next - addr != size)) {
+                if (split_large_page(entry, shift) != 0) {
+                    return;
+                }
+                leaf = 0;
+            }
+            
+            if (leaf) {
+                page_t old_entry = *entry;
+                uint64 frame = (shift == PT_SHIFT && (unmap_flags & UNMAP_FREE_FRAMES)) ? (old_entry & PAGE_FRAME) : 0;
+                *entry = 0;
+                tlb_batch_add(batch, addr, old_entry, frame);
+            } else {
+                unmap_level(batch, table_of(*entry), shift - 9, addr, next, unmap_flags);
+            }
+        }
+        
+        addr = next;
+    }
+}
+
+static void unmap_range_locked(page_directory_struct_t* dir, uint64 virtual_addr, uint64 size, uint32 unmap_flags) {
+    tlb_batch_t batch;
+    
+    tlb_batch_init(&batch, dir);
+    
+    virtual_addr &= PAGE_FRAME;
+    unmap_level(&batch, dir->pml4, PML4_SHIFT, virtual_addr, virtual_addr + ((size + PAGE_SIZE - 1) & PAGE_FRAME), unmap_flags);
+    tlb_batch_flush(&batch);
+}
+
+void unmap_range(page_directory_struct_t* dir, uint64 virtual_addr, uint64 size, uint32 unmap_flags) {
+    uint64 lock_flags = paging_lock_irqsave();
+    unmap_range_locked(dir, virtual_addr, size, unmap_flags);
+    spin_unlock_irqrestore(&paging_lock, lock_flags);
+}
+
+int map_page(uint64 virtual_addr, uint64 physical_addr, uint64 flags) {
+    return map_page_size(get_current_directory(), virtual_addr, physical_addr, flags, PAGE_SIZE);
+}
+
+void unmap_page(uint64 virtual_addr) {
+    uint64 lock_flags = paging_lock_irqsave();
+    page_directory_struct_t* dir = get_current_directory();
+    page_t* entry = walk(dir, virtual_addr, PT_SHIFT, 0, 0);
+    
+    if (entry) {
+        page_t old_entry = *entry;
+        *entry = 0;
+        invalidate_page(dir, virtual_addr, old_entry);
+    }
+    
+    spin_unlock_irqrestore(&paging_lock, lock_flags);
+}
+
+static uint64 translate(page_directory_struct_t* dir, uint64 virtual_addr) {
+    page_table_t* table = dir->pml4;
+    
+    for (uint32 shift = PML4_SHIFT; ; shift -= 9) {
+        page_t entry = table->entries[PAGE_INDEX(virtual_addr, shift)];
+        
+        if (!(entry & PAGE_PRESENT)) {
+            return 0;
+        }
+        if (shift == PT_SHIFT || (entry & PAGE_HUGE)) {
+            uint64 offset_mask = (1ULL << shift) - 1;
+            return (entry & PAGE_FRAME & ~offset_mask) + (virtual_addr & offset_mask);
+        }
+        
+        table = table_of(entry);
+    }
+}
+
+uint64 get_physical_address(uint64 virtual_addr) {
+    page_directory_struct_t* dir = get_current_directory();
+    if (!dir) {
+        return virtual_addr;
+    }
+    
+    uint64 lock_flags = paging_lock_irqsave();
+    uint64 physical_addr = translate(dir, virtual_addr);
+    spin_unlock_irqrestore(&paging_lock, lock_flags);
+    return physical_addr;
+}
+
+page_t* get_page(uint64 virtual_addr, int make, page_directory_struct_t* dir) {
+    uint64 lock_flags = paging_lock_irqsave();
+    page_t* entry = walk(dir, virtual_addr, PT_SHIFT, make ? PAGE_WRITE : 0, make);
+    spin_unlock_irqrestore(&paging_lock, lock_flags);
+    return entry;
+}
+
+void flush_tlb_entry(uint64 virtual_addr) {
     __asm__ __volatile__("invlpg (%0)" : : "r"(virtual_addr) : "memory");
 }
 
 void flush_tlb() {
     uint64 cr3;
     __asm__ __volatile__("movq %%cr3, %0" : "=r"(cr3));
-    __asm__ __volatile__("movq %0, %%cr3" : : "r"(cr3));
+    __asm__ __volatile__("movq %0, %%cr3" : : "r"(cr3) : "memory");
+}
+
+void flush_tlb_all() {
+    uint64 cr4;
+    __asm__ __volatile__("movq %%cr4, %0" : "=r"(cr4));
+    if (cr4 & CR4_PGE) {
+        __asm__ __volatile__("movq %0, %%cr4" : : "r"(cr4 & ~(uint64)CR4_PGE) : "memory");
+        __asm__ __volatile__("movq %0, %%cr4" : : "r"(cr4) : "memory");
+    } else {
+        flush_tlb();
+    }
 }
 
 void switch_page_directory(page_directory_struct_t* dir) {
-    current_directory = dir;
-    uint64 phys = dir->physical_addr;
-    __asm__ __volatile__("movq %0, %%cr3" : : "r"(phys));
+    cpu_t* cpu = smp_this_cpu();
+    uint64 cr3 = dir->physical_addr;
+    
+    cpu->page_directory = dir;
+    __sync_synchronize();
+    
+    if (pcid_enabled) {
+        cr3 |= pcid_assign(cpu, dir);
+    }
+    
+    __asm__ __volatile__("movq %0, %%cr3" : : "r"(cr3) : "memory");
 }
 
-void enable_paging() {
-    uint64 cr0;
-    __asm__ __volatile__("movq %%cr0, %0" : "=r"(cr0));
-    cr0 |= 0x80000000;
-    __asm__ __volatile__("movq %0, %%cr0" : : "r"(cr0));
+static int clone_table(page_table_t* dst, page_table_t* src, uint32 shift) {
+    for (uint32 i = 0; i < PAGE_ENTRIES; i++) {
+        page_t entry = src->entries[i];
+        
+        if (!(entry & PAGE_PRESENT) || (entry & PAGE_GLOBAL)) {
+            dst->entries[i] = entry;
+            continue;
+        }
+        
+        if (shift > PT_SHIFT && (entry & PAGE_HUGE)) {
+            if (split_large_page(&src->entries[i], shift) != 0) {
+                return -1;
+            }
+            entry = src->entries[i];
+        }
+        
+        if (shift == PT_SHIFT) {
+            if (entry & PAGE_WRITE) {
+                entry = (entry & ~(uint64)PAGE_WRITE) | PAGE_COW;
+                src->entries[i] = entry;
+            }
+            pmm_ref_page(entry & PAGE_FRAME);
+            dst->entries[i] = entry;
+            continue;
+        }
+        
+        uint64 phys;
+        page_table_t* table = alloc_table(&phys);
+        if (!table) {
+            return -1;
+        }
+        dst->entries[i] = phys | (entry & PAGE_FLAGS_MASK);
+        
+        if (clone_table(table, table_of(entry), shift - 9) != 0) {
+            return -1;
+        }
+    }
+    
+    return 0;
 }
 
+static void release_directory_table(page_table_t* table, uint32 shift) {
+    for (uint32 i = 0; i < PAGE_ENTRIES; i++) {
+        page_t entry = table->entries[i];
+        
+        if (!(entry & PAGE_PRESENT) || (entry & PAGE_GLOBAL)) {
+            continue;
+        }
+        if (shift == PT_SHIFT) {
+            pmm_unref_page(entry & PAGE_FRAME);
+        } else if (!(entry & PAGE_HUGE)) {
+            release_directory_table(table_of(entry), shift - 9);
+        }
+    }
+    
+    pmm_free_page((uintptr)table);
+}
+
+static void free_directory_locked(page_directory_struct_t* dir);
+
 page_directory_struct_t* clone_directory(page_directory_struct_t* src) {
+    uint64 lock_flags = paging_lock_irqsave();
     page_directory_struct_t* dir = create_page_directory();
     
     if (!dir) {
+        spin_unlock_irqrestore(&paging_lock, lock_flags);
         return 0;
     }
     
-    for (uint32 i = 0; i < PAGES_PER_DIR; i++) {
-        if (src->tables[i]) {
-            uint32 phys = pmm_allocate_page();
-            dir->tables[i] = (page_table_t*)(uintptr)phys;
-            dir->physical_tables[i] = src->physical_tables[i];
-            dir->directory[i] = src->directory[i];
-            
-            for (uint32 j = 0; j < PAGES_PER_TABLE; j++) {
-                page_table_t* src_table = src->tables[i];
-                page_table_t* dst_table = dir->tables[i];
-                (*dst_table)[j] = (*src_table)[j];
-            }
+    int result = clone_table(dir->pml4, src->pml4, PML4_SHIFT);
+    
+    if (result == 0 && src->vmas) {
+        dir->vmas = vma_clone(src->vmas);
+        if (!dir->vmas) {
+            result = -1;
         }
     }
     
+    invalidate_all(src, 0);
+    
+    if (result != 0) {
+        free_directory_locked(dir);
+        dir = 0;
+    }
+    
+    spin_unlock_irqrestore(&paging_lock, lock_flags);
     return dir;
 }
 
-void page_fault_handler(uint32 error_code) {
+static void free_directory_locked(page_directory_struct_t* dir) {    
+    for (uint32 id = 0; id < MAX_CPUS; id++) {
+        if (smp_get_cpu(id)->page_directory == dir) {
+            return;
+        }
+    }
+    
+    vma_free_all(&dir->vmas);
+    release_directory_table(dir->pml4, PML4_SHIFT);
+    kfree(dir);
+}
+
+void free_directory(page_directory_struct_t* dir) {
+    if (!dir || dir == kernel_directory) {
+        return;
+    }
+    
+    uint64 lock_flags = paging_lock_irqsave();
+    
+    for (uint32 id = 0; id < MAX_CPUS; id++) {
+        if (smp_get_cpu(id)->page_directory == dir) {
+            spin_unlock_irqrestore(&paging_lock, lock_flags);
+            return;
+        }
+    }
+    
+    free_directory_locked(dir);
+    spin_unlock_irqrestore(&paging_lock, lock_flags);
+}
+
+static int handle_cow_fault_locked(page_directory_struct_t* dir, uint64 virtual_addr) {
+    page_t* entry = walk(dir, virtual_addr, PT_SHIFT, 0, 0);
+    if (entry && (*entry & PAGE_PRESENT) && (*entry & PAGE_WRITE)) {
+        flush_tlb_entry(virtual_addr);
+        return 0;
+    }
+    if (!entry || !(*entry & PAGE_PRESENT) || !(*entry & PAGE_COW)) {
+        return -1;
+    }
+    
+    page_t old_entry = *entry;
+    uint64 frame = old_entry & PAGE_FRAME;
+    uint64 flags = (old_entry & PAGE_FLAGS_MASK & ~(uint64)PAGE_COW) | PAGE_WRITE;
+    
+    if (pmm_get_page_refcount(frame) > 1) {
+        uint64 copy = pmm_allocate_page();
+        if (!copy) {
+            return -1;
+        }
+        memcpy(PHYS_TO_VIRT(copy), PHYS_TO_VIRT(frame), PAGE_SIZE);
+        frame = copy;
+    }
+    
+    *entry = frame | flags;
+    invalidate_page(dir, virtual_addr, old_entry);
+    
+    if (frame != (old_entry & PAGE_FRAME)) {
+        pmm_unref_page(old_entry & PAGE_FRAME);
+    }
+    return 0;
+}
+
+int handle_cow_fault(uint64 virtual_addr) {
+    uint64 lock_flags = paging_lock_irqsave();
+    int result = handle_cow_fault_locked(get_current_directory(), virtual_addr);
+    spin_unlock_irqrestore(&paging_lock, lock_flags);
+    return result;
+}
+
+static int handle_demand_fault_locked(page_directory_struct_t* dir, uint64 virtual_addr, uint64 error_code) {
+    vma_t* vma = vma_find(dir->vmas, virtual_addr);
+    if (!vma) {
+        return -1;
+    }
+    if ((error_code & 0x2) && !(vma->flags & PAGE_WRITE)) {
+        return -1;
+    }
+    
+    page_t* entry = walk(dir, virtual_addr, PT_SHIFT, 0, 0);
+    if (entry && (*entry & PAGE_PRESENT)) {
+        return 0;
+    }
+    
+    uint64 frame = pmm_allocate_page_flags(PMM_ALLOC_ZERO);
+    if (!frame) {
+        return -1;
+    }
+    
+    if (map_page_size_locked(dir, virtual_addr & PAGE_FRAME, frame, PAGE_PRESENT | vma->flags, PAGE_SIZE) != 0) {
+        pmm_free_page(frame);
+        return -1;
+    }
+    
+    return 0;
+}
+
+int handle_demand_fault(uint64 virtual_addr, uint64 error_code) {
+    uint64 lock_flags = paging_lock_irqsave();
+    int result = handle_demand_fault_locked(get_current_directory(), virtual_addr, error_code);
+    spin_unlock_irqrestore(&paging_lock, lock_flags);
+    return result;
+}
+
+void page_fault_handler(uint64 error_code) {
     uint64 faulting_address;
     __asm__ __volatile__("movq %%cr2, %0" : "=r"(faulting_address));
     
+    if (get_current_directory()) {
+        if (!(error_code & 0x1) && handle_demand_fault(faulting_address, error_code) == 0) {
+            return;
+        }
+        if ((error_code & 0x3) == 0x3 && handle_cow_fault(faulting_address) == 0) {
+            return;
+        }
+    }
+    
     set_screen_color(0x0C, 0x00);
     printf("Page Fault! ( ");
     
@@ -211,12 +806,12 @@ void page_fault_handler(uint32 error_code) {
     }
     
     printf(") at 0x");
-    char hex_str[9];
-    for (int i = 7; i >= 0; i--) {
+    char hex_str[17];
+    for (int i = 15; i >= 0; i--) {
         uint32 nibble = (faulting_address >> (i * 4)) & 0xF;
-        hex_str[7-i] = (nibble < 10) ? ('0' + nibble) : ('A' + nibble - 10);
+        hex_str[15-i] = (nibble < 10) ? ('0' + nibble) : ('A' + nibble - 10);
     }
-    hex_str[8] = '\0';
+    hex_str[16] = '\0';
     printf(hex_str);
     printf("\n");
     
@@ -227,16 +822,63 @@ void page_fault_handler(uint32 error_code) {
     }
 }
 
+static void enable_write_protect() {
+    uint64 cr0;
+    __asm__ __volatile__("movq %%cr0, %0" : "=r"(cr0));
+    __asm__ __volatile__("movq %0, %%cr0" : : "r"(cr0 | CR0_WP) : "memory");
+}
+
 void init_paging() {
+    uint32 eax, ebx, ecx, edx;
+    cpuid(1, &eax, &ebx, &ecx, &edx);
+    int pcid_supported = (ecx >> 17) & 1;
+    
+    cpuid(0x80000000, &eax, &ebx, &ecx, &edx);
+    if (eax >= 0x80000001) {
+        cpuid(0x80000001, &eax, &ebx, &ecx, &edx);
+        huge_1g_supported = (edx >> 26) & 1;
+    }
+    
+    smp_init_bsp();
+    
     kernel_directory = create_page_directory();
-    current_directory = kernel_directory;
+    if (!kernel_directory) {
+        return;
+    }
+    smp_this_cpu()->page_directory = kernel_directory;
     
     map_kernel_space();
     
-    set_idt_gate(14, (uint64)page_fault_handler);
+    set_idt_gate(14, (uint64)page_fault_entry);
+    
+    switch_page_directory(kernel_directory);
+    
+    uint64 cr4;
+    __asm__ __volatile__("movq %%cr4, %0" : "=r"(cr4));
+    cr4 |= CR4_PGE;
+    if (pcid_supported) {
+        cr4 |= CR4_PCIDE;
+    }
+    __asm__ __volatile__("movq %0, %%cr4" : : "r"(cr4) : "memory");
+    pcid_enabled = pcid_supported;
+    
+    enable_write_protect();
     
+    vspace_init(&kernel_vspace, VALLOC_BASE, VALLOC_SIZE);
+    pmm_init_high_memory();
+}
+
+void paging_init_ap() {
+    uint64 cr4;
+    __asm__ __volatile__("movq %%cr4, %0" : "=r"(cr4));
+    cr4 |= CR4_PGE;
+    if (pcid_enabled) {
+        cr4 |= CR4_PCIDE;
+    }
+    __asm__ __volatile__("movq %0, %%cr4" : : "r"(cr4) : "memory");
     switch_page_directory(kernel_directory);
-    enable_paging();
+    
+    enable_write_protect();
 }
 
 page_directory_struct_t* get_kernel_directory() {
@@ -244,31 +886,36 @@ page_directory_struct_t* get_kernel_directory() {
 }
 
 page_directory_struct_t* get_current_directory() {
-    return current_directory;
+    return smp_this_cpu()->page_directory;
 }
 
 void* valloc(uint32 size) {
-    uint32 num_pages = (size + PAGE_SIZE - 1) / PAGE_SIZE;
-    static uint32 next_virt_addr = 0xC0000000;
-    
-    uint32 start_addr = next_virt_addr;
+    uint64 length = ((uint64)size + PAGE_SIZE - 1) & PAGE_FRAME;
+    uint64 lock_flags = paging_lock_irqsave();
     
-    for (uint32 i = 0; i < num_pages; i++) {
-        uint32 phys = pmm_allocate_page();
-        map_page(next_virt_addr, phys, PAGE_PRESENT | PAGE_WRITE);
-        next_virt_addr += PAGE_SIZE;
+    uint64 start_addr = vspace_alloc(&kernel_vspace, length);
+    if (start_addr && !vma_insert(&get_current_directory()->vmas, start_addr, start_addr + length, PAGE_WRITE)) {
+        vspace_free(&kernel_vspace, start_addr, length);
+        start_addr = 0;
     }
     
+    spin_unlock_irqrestore(&paging_lock, lock_flags);
     return (void*)(uintptr)start_addr;
 }
 
 void vfree(void* ptr) {
-    uintptr addr = (uintptr)ptr;
-    addr &= PAGE_FRAME;
+    uint64 lock_flags = paging_lock_irqsave();
+    page_directory_struct_t* dir = get_current_directory();
+    vma_t* vma = vma_find(dir->vmas, (uintptr)ptr);
     
-    uint32 phys = get_physical_address(addr);
-    if (phys) {
-        pmm_free_page(phys);
-        unmap_page(addr);
+    if (vma) {
+        uint64 start = vma->start;
+        uint64 length = vma->end - vma->start;
+        
+        unmap_range_locked(dir, start, length, UNMAP_FREE_FRAMES);
+        vma_remove(&dir->vmas, vma);
+        vspace_free(&kernel_vspace, start, length);
     }
+    
+    spin_unlock_irqrestore(&paging_lock, lock_flags);
 }
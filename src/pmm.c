@@ -20,163 +20,657 @@
 #include "../include/screen.h"
 #include "../include/string.h"
 #include "../include/util.h"
+#include "../include/spinlock.h"
 
-static uint32 memory_bitmap[MEMORY_MAP_SIZE / 4];
+extern uint8 kernel_end[];
+
+static uint64* memory_bitmap;
+static uint16* frame_refs;
 static uint32 total_blocks;
-static uint32 used_blocks;
-static uint32 total_memory_size;
+
+static pmm_region_t regions[PMM_MAX_REGIONS];
+static uint32 region_count;
+
+static pmm_zone_t zones[PMM_ZONE_COUNT];
+static pmm_zero_pool_t zero_pools[PMM_ZERO_POOL_ORDERS];
+static spinlock_t pmm_lock = SPINLOCK_INIT;
 
 static inline void pmm_set_bit(uint32 bit) {
-    memory_bitmap[bit / 32] |= (1 << (bit % 32));
+    memory_bitmap[bit / 64] |= (1ULL << (bit % 64));
 }
 
 static inline void pmm_clear_bit(uint32 bit) {
-    memory_bitmap[bit / 32] &= ~(1 << (bit % 32));
+    memory_bitmap[bit / 64] &= ~(1ULL << (bit % 64));
 }
 
-static inline uint32 pmm_test_bit(uint32 bit) {
-    return memory_bitmap[bit / 32] & (1 << (bit % 32));
+static inline int pmm_test_bit(uint32 bit) {
+    return (memory_bitmap[bit / 64] >> (bit % 64)) & 1;
 }
 
-static int pmm_find_first_free() {
-    for (uint32 i = 0; i < total_blocks / 32; i++) {
-        if (memory_bitmap[i] != 0xFFFFFFFF) {
-            for (int j = 0; j < 32; j++) {
-                int bit = 1 << j;
-                if (!(memory_bitmap[i] & bit)) {
-                    return i * 32 + j;
-                }
-            }
-        }
+static inline int bitmap_test(pmm_bitmap_t* bitmap, uint32 bit) {
+    return (bitmap->leaf[bit / 64] >> (bit % 64)) & 1;
+}
+
+static inline void bitmap_set(pmm_bitmap_t* bitmap, uint32 bit) {
+    uint32 word = bit / 64;
+    bitmap->leaf[word] |= (1ULL << (bit % 64));
+    bitmap->summary[word / 64] |= (1ULL << (word % 64));
+}
+
+static inline void bitmap_clear(pmm_bitmap_t* bitmap, uint32 bit) {
+    uint32 word = bit / 64;
+    bitmap->leaf[word] &= ~(1ULL << (bit % 64));
+    if (bitmap->leaf[word] == 0) {
+        bitmap->summary[word / 64] &= ~(1ULL << (word % 64));
     }
-    return -1;
 }
 
-static int pmm_find_first_free_s(uint32 count) {
-    if (count == 0) {
+static int bitmap_find_from(pmm_bitmap_t* bitmap, uint32 start_word) {
+    uint32 summary = start_word / 64;
+    if (summary >= bitmap->summary_words) {
         return -1;
     }
     
-    if (count == 1) {
-        return pmm_find_first_free();
+    uint64 mask = bitmap->summary[summary] & (~0ULL << (start_word % 64));
+    
+    while (!mask) {
+        if (++summary >= bitmap->summary_words) {
+            return -1;
+        }
+        mask = bitmap->summary[summary];
+    }
+    
+    uint32 word = summary * 64 + __builtin_ctzll(mask);
+    return word * 64 + __builtin_ctzll(bitmap->leaf[word]);
+}
+
+static int bitmap_find_next(pmm_bitmap_t* bitmap) {
+    int bit = bitmap_find_from(bitmap, bitmap->hint);
+    
+    if (bit < 0 && bitmap->hint > 0) {
+        bit = bitmap_find_from(bitmap, 0);
+    }
+    if (bit >= 0) {
+        bitmap->hint = bit / 64;
     }
     
-    for (uint32 i = 0; i < total_blocks; i++) {
-        int bit = pmm_test_bit(i);
-        if (!bit) {
-            uint32 starting_bit = i;
-            uint32 free_count = 0;
-            
-            for (uint32 j = i; j < total_blocks; j++) {
-                if (!pmm_test_bit(j)) {
-                    free_count++;
+    return bit;
+}
+
+static inline int buddy_test(pmm_zone_t* zone, uint32 order, uint32 index) {
+    return bitmap_test(&zone->free_map[order], index);
+}
+
+static void buddy_insert(pmm_zone_t* zone, uint32 order, uint32 index) {
+    bitmap_set(&zone->free_map[order], index);
+    zone->free_count[order]++;
+}
+
+static void buddy_remove(pmm_zone_t* zone, uint32 order, uint32 index) {
+    bitmap_clear(&zone->free_map[order], index);
+    zone->free_count[order]--;
+}
+
+static uint32 order_for_count(uint32 count) {
+    uint32 order = 0;
+    while ((1u << order) < count) {
+        order++;
+    }
+    return order;
+}
+
+static void buddy_free_block(pmm_zone_t* zone, uint32 frame, uint32 order) {
+    uint32 size = zone->end - zone->start;
+    
+    while (order < PMM_MAX_ORDER) {
+        uint32 buddy = frame ^ (1u << order);
+        if (buddy + (1u << order) > size || !buddy_test(zone, order, buddy >> order)) {
+            break;
+        }
+        buddy_remove(zone, order, buddy >> order);
+        frame &= ~(1u << order);
+        order++;
+    }
+    buddy_insert(zone, order, frame >> order);
+}
+
+static void buddy_free_range(pmm_zone_t* zone, uint32 frame, uint32 count) {
+    while (count > 0) {
+        uint32 order = 0;
+        while (order < PMM_MAX_ORDER && !(frame & (1u << order)) && (2u << order) <= count) {
+            order++;
+        }
+        buddy_free_block(zone, frame, order);
+        frame += 1u << order;
+        count -= 1u << order;
+    }
+}
+
+static void buddy_split(pmm_zone_t* zone, uint32 frame, uint32 from_order, uint32 to_order) {
+    while (from_order > to_order) {
+        from_order--;
+        buddy_insert(zone, from_order, (frame + (1u << from_order)) >> from_order);
+    }
+}
+
+static int buddy_alloc(pmm_zone_t* zone, uint32 order) {
+    for (uint32 k = order; k <= PMM_MAX_ORDER; k++) {
+        if (zone->free_count[k] == 0) {
+            continue;
+        }
+        
+        int index = bitmap_find_next(&zone->free_map[k]);
+        if (index < 0) {
+            continue;
+        }
+        
+        uint32 frame = (uint32)index << k;
+        buddy_remove(zone, k, index);
+        buddy_split(zone, frame, k, order);
+        return frame;
+    }
+    
+    return -1;
+}
+
+static void buddy_reserve_frame(pmm_zone_t* zone, uint32 frame) {
+    for (uint32 k = 0; k <= PMM_MAX_ORDER; k++) {
+        uint32 block = frame & ~((1u << k) - 1);
+        if (buddy_test(zone, k, block >> k)) {
+            buddy_remove(zone, k, block >> k);
+            while (k > 0) {
+                k--;
+                uint32 half = 1u << k;
+                if (frame & half) {
+                    buddy_insert(zone, k, block >> k);
+                    block += half;
                 } else {
-                    break;
-                }
-                
-                if (free_count == count) {
-                    return starting_bit;
+                    buddy_insert(zone, k, (block + half) >> k);
                 }
             }
+            return;
+        }
+    }
+}
+
+static pmm_zone_t* pmm_zone_of(uint32 frame) {
+    for (uint32 i = 0; i < PMM_ZONE_COUNT; i++) {
+        if (frame >= zones[i].start && frame < zones[i].end) {
+            return &zones[i];
         }
     }
+    return 0;
+}
+
+static void pmm_update_watermarks() {
+    uint32 higher = 0;
     
-    return -1;
+    for (int i = PMM_ZONE_COUNT - 1; i >= 0; i--) {
+        zones[i].watermark = higher ? zones[i].managed_blocks / PMM_ZONE_RESERVE_RATIO : 0;
+        higher += zones[i].managed_blocks;
+    }
 }
 
-void init_pmm(uint32 total_memory) {
-    total_memory_size = total_memory;
-    total_blocks = total_memory / PMM_BLOCK_SIZE;
-    used_blocks = total_blocks;
+static uint32 pmm_release(uint32 frame, uint32 end) {
+    uint32 released = 0;
+    
+    if (end > total_blocks) {
+        end = total_blocks;
+    }
+    if (frame == 0) {
+        frame = 1;
+    }
+    
+    while (frame < end) {
+        pmm_zone_t* zone = pmm_zone_of(frame);
+        uint32 zone_end = end < zone->end ? end : zone->end;
+        
+        while (frame < zone_end && !pmm_test_bit(frame)) {
+            frame++;
+        }
+        uint32 run = frame;
+        while (frame < zone_end && pmm_test_bit(frame)) {
+            pmm_clear_bit(frame);
+            frame_refs[frame] = 0;
+            frame++;
+        }
+        if (frame > run) {
+            buddy_free_range(zone, run - zone->start, frame - run);
+            zone->free_blocks += frame - run;
+            released += frame - run;
+        }
+    }
     
-    memset(memory_bitmap, 0xFF, sizeof(memory_bitmap));
+    return released;
 }
 
-void pmm_init_region(uint32 base, uint32 size) {
-    uint32 align_base = base / PMM_BLOCK_SIZE;
-    uint32 blocks = size / PMM_BLOCK_SIZE;
+static uint64 pmm_take(pmm_zone_t* zone, uint32 count, int fallback) {
+    uint32 order = order_for_count(count);
+    if (order > PMM_MAX_ORDER || zone->free_blocks < count) {
+        return 0;
+    }
+    if (fallback && zone->free_blocks - count < zone->watermark) {
+        return 0;
+    }
+    
+    int frame = buddy_alloc(zone, order);
+    if (frame < 0) {
+        return 0;
+    }
     
-    for (; blocks > 0; blocks--) {
-        pmm_clear_bit(align_base++);
-        used_blocks--;
+    if ((1u << order) > count) {
+        buddy_free_range(zone, frame + count, (1u << order) - count);
     }
     
-    pmm_set_bit(0);
+    frame += zone->start;
+    for (uint32 i = 0; i < count; i++) {
+        pmm_set_bit(frame + i);
+    }
+    zone->free_blocks -= count;
+    
+    return (uint64)frame * PMM_BLOCK_SIZE;
 }
 
-void pmm_deinit_region(uint32 base, uint32 size) {
-    uint32 align_base = base / PMM_BLOCK_SIZE;
-    uint32 blocks = size / PMM_BLOCK_SIZE;
+static uint64 pmm_take_any(uint32 count) {
+    for (int i = PMM_ZONE_COUNT - 1; i >= 0; i--) {
+        uint64 page = pmm_take(&zones[i], count, i != PMM_ZONE_COUNT - 1);
+        if (page) {
+            return page;
+        }
+    }
+    return 0;
+}
+
+static uint64 pmm_take_zeroed(uint32 count) {
+    uint32 order = order_for_count(count);
+    
+    if (order < PMM_ZERO_POOL_ORDERS && (1u << order) == count && zero_pools[order].count > 0) {
+        pmm_zero_pool_t* pool = &zero_pools[order];
+        return pool->blocks[--pool->count];
+    }
     
-    for (; blocks > 0; blocks--) {
-        pmm_set_bit(align_base++);
-        used_blocks++;
+    uint64 page = pmm_take_any(count);
+    if (page) {
+        memset((void*)(uintptr)page, 0, (uint64)count * PMM_BLOCK_SIZE);
     }
+    return page;
+}
+
+static uint64 bitmap_words(uint32 bits) {
+    return (bits + 63) / 64;
 }
 
-uint32 pmm_allocate_page() {
-    int frame = pmm_find_first_free();
+static void pmm_zone_bounds(uint32 blocks, uint32* bounds) {
+    uint32 limits[PMM_ZONE_COUNT] = {
+        PMM_ZONE_DMA_LIMIT / PMM_BLOCK_SIZE,
+        PMM_ZONE_DMA32_LIMIT / PMM_BLOCK_SIZE,
+        blocks
+    };
     
-    if (frame == -1) {
-        return 0;
+    bounds[0] = 0;
+    for (uint32 i = 0; i < PMM_ZONE_COUNT; i++) {
+        uint32 limit = limits[i] < blocks ? limits[i] : blocks;
+        bounds[i + 1] = limit > bounds[i] ? limit : bounds[i];
     }
+}
+
+uint64 pmm_metadata_size(uint64 total_memory) {
+    uint32 blocks = total_memory / PMM_BLOCK_SIZE;
+    uint32 bounds[PMM_ZONE_COUNT + 1];
+    uint64 words = bitmap_words(blocks) + (blocks + 3) / 4;
     
-    pmm_set_bit(frame);
-    used_blocks++;
+    pmm_zone_bounds(blocks, bounds);
+    for (uint32 i = 0; i < PMM_ZONE_COUNT; i++) {
+        for (uint32 k = 0; k <= PMM_MAX_ORDER; k++) {
+            uint64 leaf_words = bitmap_words((bounds[i + 1] - bounds[i]) >> k);
+            words += leaf_words + bitmap_words(leaf_words);
+        }
+    }
     
-    return frame * PMM_BLOCK_SIZE;
+    return words * sizeof(uint64);
 }
 
-void pmm_free_page(uint32 page) {
-    uint32 frame = page / PMM_BLOCK_SIZE;
-    pmm_clear_bit(frame);
-    used_blocks--;
+void init_pmm(uint64 total_memory, void* metadata) {
+    static char* zone_names[PMM_ZONE_COUNT] = { "DMA", "DMA32", "Normal" };
+    uint32 bounds[PMM_ZONE_COUNT + 1];
+    
+    total_blocks = total_memory / PMM_BLOCK_SIZE;
+    pmm_zone_bounds(total_blocks, bounds);
+    
+    memset(metadata, 0, pmm_metadata_size(total_memory));
+    
+    uint64* words = (uint64*)metadata;
+    memory_bitmap = words;
+    memset(memory_bitmap, 0xFF, bitmap_words(total_blocks) * sizeof(uint64));
+    words += bitmap_words(total_blocks);
+    frame_refs = (uint16*)words;
+    words += (total_blocks + 3) / 4;
+    
+    for (uint32 k = 0; k < PMM_ZERO_POOL_ORDERS; k++) {
+        zero_pools[k].count = 0;
+        zero_pools[k].target = PMM_ZERO_POOL_SIZE >> (2 * k);
+    }
+    
+    for (uint32 i = 0; i < PMM_ZONE_COUNT; i++) {
+        pmm_zone_t* zone = &zones[i];
+        zone->name = zone_names[i];
+        zone->start = bounds[i];
+        zone->end = bounds[i + 1];
+        zone->managed_blocks = 0;
+        zone->free_blocks = 0;
+        zone->watermark = 0;
+        
+        for (uint32 k = 0; k <= PMM_MAX_ORDER; k++) {
+            pmm_bitmap_t* bitmap = &zone->free_map[k];
+            bitmap->leaf_words = bitmap_words((zone->end - zone->start) >> k);
+            bitmap->summary_words = bitmap_words(bitmap->leaf_words);
+            bitmap->leaf = words;
+            words += bitmap->leaf_words;
+            bitmap->summary = words;
+            words += bitmap->summary_words;
+            bitmap->hint = 0;
+            zone->free_count[k] = 0;
+        }
+    }
 }
 
-uint32 pmm_allocate_pages(uint32 count) {
-    int frame = pmm_find_first_free_s(count);
+static void pmm_add_region(uint64 base, uint64 size) {
+    if (region_count < PMM_MAX_REGIONS) {
+        regions[region_count].base = base;
+        regions[region_count].size = size;
+        region_count++;
+    }
+}
+
+void init_pmm_multiboot(multiboot_info_t* info) {
+    region_count = 0;
+    
+    if (info) {
+        uint8* end = (uint8*)info + info->total_size;
+        multiboot_tag_t* tag = (multiboot_tag_t*)(info + 1);
+        
+        while ((uint8*)tag < end && tag->type != MULTIBOOT_TAG_TYPE_END) {
+            if (tag->type == MULTIBOOT_TAG_TYPE_MMAP) {
+                multiboot_tag_mmap_t* mmap = (multiboot_tag_mmap_t*)tag;
+                uint8* entry = (uint8*)(mmap + 1);
+                
+                while (entry + mmap->entry_size <= (uint8*)tag + tag->size) {
+                    multiboot_memory_map_t* map = (multiboot_memory_map_t*)entry;
+                    if (map->type == MULTIBOOT_MEMORY_AVAILABLE && map->len > 0) {
+                        pmm_add_region(map->addr, map->len);
+                    }
+                    entry += mmap->entry_size;
+                }
+            }
+            tag = (multiboot_tag_t*)((uint8*)tag + ((tag->size + 7) & ~7));
+        }
+    }
+    
+    if (region_count == 0) {
+        pmm_add_region(0, PMM_FALLBACK_MEMORY_SIZE);
+    }
+    
+    uint64 total_memory = 0;
+    for (uint32 i = 0; i < region_count; i++) {
+        uint64 end = regions[i].base + regions[i].size;
+        if (end > total_memory) {
+            total_memory = end;
+        }
+    }
+    
+    uint64 metadata = ((uintptr)kernel_end + PMM_BLOCK_SIZE - 1) & ~(uint64)(PMM_BLOCK_SIZE - 1);
+    uint64 reserved_end = metadata + pmm_metadata_size(total_memory);
+    init_pmm(total_memory, (void*)(uintptr)metadata);
     
-    if (frame == -1) {
+    for (uint32 i = 0; i < region_count; i++) {
+        uint64 base = regions[i].base;
+        uint64 end = base + regions[i].size;
+        
+        if (base < reserved_end) {
+            base = reserved_end;
+        }
+        if (end > PMM_BOOT_MAPPED_LIMIT) {
+            end = PMM_BOOT_MAPPED_LIMIT;
+        }
+        if (base < end) {
+            pmm_init_region(base, end - base);
+        }
+    }
+}
+
+void pmm_init_region(uint64 base, uint64 size) {
+    uint64 frame = (base + PMM_BLOCK_SIZE - 1) / PMM_BLOCK_SIZE;
+    uint64 end = (base + size) / PMM_BLOCK_SIZE;
+    
+    if (end > total_blocks) {
+        end = total_blocks;
+    }
+    
+    while (frame < end) {
+        pmm_zone_t* zone = pmm_zone_of(frame);
+        uint32 zone_end = end < zone->end ? end : zone->end;
+        zone->managed_blocks += pmm_release(frame, zone_end);
+        frame = zone_end;
+    }
+    
+    pmm_update_watermarks();
+}
+
+void pmm_init_high_memory() {
+    for (uint32 i = 0; i < region_count; i++) {
+        uint64 base = regions[i].base;
+        uint64 end = base + regions[i].size;
+        
+        if (base < PMM_BOOT_MAPPED_LIMIT) {
+            base = PMM_BOOT_MAPPED_LIMIT;
+        }
+        if (base < end) {
+            pmm_init_region(base, end - base);
+        }
+    }
+}
+
+void pmm_deinit_region(uint64 base, uint64 size) {
+    uint64 frame = base / PMM_BLOCK_SIZE;
+    uint64 end = (base + size + PMM_BLOCK_SIZE - 1) / PMM_BLOCK_SIZE;
+    
+    if (end > total_blocks) {
+        end = total_blocks;
+    }
+    
+    for (; frame < end; frame++) {
+        if (!pmm_test_bit(frame)) {
+            pmm_zone_t* zone = pmm_zone_of(frame);
+            buddy_reserve_frame(zone, frame - zone->start);
+            pmm_set_bit(frame);
+            zone->free_blocks--;
+            zone->managed_blocks--;
+        }
+    }
+    
+    pmm_update_watermarks();
+}
+
+static void pmm_drain_locked() {
+    for (uint32 k = 0; k < PMM_ZERO_POOL_ORDERS; k++) {
+        pmm_zero_pool_t* pool = &zero_pools[k];
+        while (pool->count > 0) {
+            uint64 frame = pool->blocks[--pool->count] / PMM_BLOCK_SIZE;
+            pmm_release(frame, frame + (1u << k));
+        }
+    }
+}
+
+uint64 pmm_allocate_page() {
+    return pmm_allocate_pages_flags(1, 0);
+}
+
+uint64 pmm_allocate_page_flags(uint32 flags) {
+    return pmm_allocate_pages_flags(1, flags);
+}
+
+void pmm_free_page(uint64 page) {
+    pmm_free_pages(page, 1);
+}
+
+uint64 pmm_allocate_pages(uint32 count) {
+    return pmm_allocate_pages_flags(count, 0);
+}
+
+uint64 pmm_allocate_pages_flags(uint32 count, uint32 flags) {
+    if (count == 0) {
         return 0;
     }
     
-    for (uint32 i = 0; i < count; i++) {
-        pmm_set_bit(frame + i);
+    uint64 lock_flags = spin_lock_irqsave(&pmm_lock);
+    
+    uint64 page = (flags & PMM_ALLOC_ZERO) ? pmm_take_zeroed(count) : pmm_take_any(count);
+    if (!page) {
+        pmm_drain_locked();
+        page = (flags & PMM_ALLOC_ZERO) ? pmm_take_zeroed(count) : pmm_take_any(count);
     }
     
-    used_blocks += count;
+    spin_unlock_irqrestore(&pmm_lock, lock_flags);
+    return page;
+}
+
+int pmm_refill_zero_pool() {
+    uint64 flags = spin_lock_irqsave(&pmm_lock);
+    
+    for (uint32 k = 0; k < PMM_ZERO_POOL_ORDERS; k++) {
+        pmm_zero_pool_t* pool = &zero_pools[k];
+        if (pool->count >= pool->target) {
+            continue;
+        }
+        
+        uint64 block = pmm_take_any(1u << k);
+        spin_unlock_irqrestore(&pmm_lock, flags);
+        if (!block) {
+            return 0;
+        }
+        
+        memset((void*)(uintptr)block, 0, (uint64)PMM_BLOCK_SIZE << k);
+        
+        flags = spin_lock_irqsave(&pmm_lock);
+        if (pool->count < pool->target) {
+            pool->blocks[pool->count++] = block;
+        } else {
+            pmm_release(block / PMM_BLOCK_SIZE, block / PMM_BLOCK_SIZE + (1u << k));
+        }
+        spin_unlock_irqrestore(&pmm_lock, flags);
+        return 1;
+    }
     
-    return frame * PMM_BLOCK_SIZE;
+    spin_unlock_irqrestore(&pmm_lock, flags);
+    return 0;
 }
 
-void pmm_free_pages(uint32 page, uint32 count) {
-    uint32 frame = page / PMM_BLOCK_SIZE;
+void pmm_drain_zero_pool() {
+    uint64 flags = spin_lock_irqsave(&pmm_lock);
+    pmm_drain_locked();
+    spin_unlock_irqrestore(&pmm_lock, flags);
+}
+
+uint64 pmm_allocate_zone_pages(uint32 zone, uint32 count) {
+    if (count == 0 || zone >= PMM_ZONE_COUNT) {
+        return 0;
+    }
     
-    for (uint32 i = 0; i < count; i++) {
-        pmm_clear_bit(frame + i);
+    uint64 flags = spin_lock_irqsave(&pmm_lock);
+    uint64 page = pmm_take(&zones[zone], count, 0);
+    spin_unlock_irqrestore(&pmm_lock, flags);
+    return page;
+}
+
+uint64 pmm_allocate_dma_pages(uint32 count) {
+    return pmm_allocate_zone_pages(PMM_ZONE_DMA, count);
+}
+
+void pmm_free_pages(uint64 page, uint32 count) {
+    uint64 frame = page / PMM_BLOCK_SIZE;
+    
+    if (frame >= total_blocks) {
+        return;
+    }
+    
+    uint64 flags = spin_lock_irqsave(&pmm_lock);
+    pmm_release(frame, frame + count);
+    spin_unlock_irqrestore(&pmm_lock, flags);
+}
+
+void pmm_ref_page(uint64 page) {
+    uint64 frame = page / PMM_BLOCK_SIZE;
+    uint64 flags = spin_lock_irqsave(&pmm_lock);
+    if (frame < total_blocks && pmm_test_bit(frame)) {
+        frame_refs[frame]++;
+    }
+    spin_unlock_irqrestore(&pmm_lock, flags);
+}
+
+void pmm_unref_page(uint64 page) {
+    uint64 frame = page / PMM_BLOCK_SIZE;
+    if (frame >= total_blocks) {
+        return;
     }
     
-    used_blocks -= count;
+    uint64 flags = spin_lock_irqsave(&pmm_lock);
+    if (frame_refs[frame] > 0) {
+        frame_refs[frame]--;
+    } else {
+        pmm_release(frame, frame + 1);
+    }
+    spin_unlock_irqrestore(&pmm_lock, flags);
+}
+
+uint32 pmm_get_page_refcount(uint64 page) {
+    uint64 frame = page / PMM_BLOCK_SIZE;
+    if (frame >= total_blocks || !pmm_test_bit(frame)) {
+        return 0;
+    }
+    return frame_refs[frame] + 1;
 }
 
-uint32 pmm_get_total_memory() {
-    return total_blocks * PMM_BLOCK_SIZE;
+uint64 pmm_get_total_memory() {
+    uint64 blocks = 0;
+    for (uint32 i = 0; i < PMM_ZONE_COUNT; i++) {
+        blocks += zones[i].managed_blocks;
+    }
+    return blocks * PMM_BLOCK_SIZE;
+}
+
+uint64 pmm_get_free_memory() {
+    uint64 blocks = 0;
+    for (uint32 i = 0; i < PMM_ZONE_COUNT; i++) {
+        blocks += zones[i].free_blocks;
+    }
+    for (uint32 k = 0; k < PMM_ZERO_POOL_ORDERS; k++) {
+        blocks += (uint64)zero_pools[k].count << k;
+    }
+    return blocks * PMM_BLOCK_SIZE;
 }
 
-uint32 pmm_get_free_memory() {
-    return (total_blocks - used_blocks) * PMM_BLOCK_SIZE;
+uint64 pmm_get_used_memory() {
+    return pmm_get_total_memory() - pmm_get_free_memory();
 }
 
-uint32 pmm_get_used_memory() {
-    return used_blocks * PMM_BLOCK_SIZE;
+pmm_zone_t* pmm_get_zone(uint32 zone) {
+    return zone < PMM_ZONE_COUNT ? &zones[zone] : 0;
 }
 
 uint32 pmm_get_block_count() {
     return total_blocks;
 }
 
-int pmm_is_page_allocated(uint32 page) {
-    uint32 frame = page / PMM_BLOCK_SIZE;
+pmm_region_t* pmm_get_regions(uint32* count) {
+    *count = region_count;
+    return regions;
+}
+
+int pmm_is_page_allocated(uint64 page) {
+    uint64 frame = page / PMM_BLOCK_SIZE;
+    if (frame >= total_blocks) {
+        return 1;
+    }
     return pmm_test_bit(frame);
 }
 
@@ -199,29 +693,49 @@ void pmm_print_stats() {
     int_to_ascii(pmm_get_free_memory() / 1024, free_str);
     printf(free_str);
     printf(" KB\n");
-}
-
-uint32 pmm_allocate_dma_pages(uint32 count) {
-    uint32 dma_limit = 16 * 1024 * 1024;
-    uint32 max_frame = dma_limit / PMM_BLOCK_SIZE;
     
-    for (uint32 i = 1; i < max_frame - count; i++) {
-        int found = 1;
-        for (uint32 j = 0; j < count; j++) {
-            if (pmm_test_bit(i + j)) {
-                found = 0;
-                break;
-            }
+    printf("Zeroed Pool: ");
+    char pool_str[20];
+    uint32 pool_pages = 0;
+    for (uint32 k = 0; k < PMM_ZERO_POOL_ORDERS; k++) {
+        pool_pages += zero_pools[k].count << k;
+    }
+    int_to_ascii(pool_pages, pool_str);
+    printf(pool_str);
+    printf(" pages\n");
+    
+    printf("Memory Regions: ");
+    char region_str[20];
+    int_to_ascii(region_count, region_str);
+    printf(region_str);
+    printf("\n");
+    
+    for (uint32 i = 0; i < PMM_ZONE_COUNT; i++) {
+        pmm_zone_t* zone = &zones[i];
+        if (zone->managed_blocks == 0) {
+            continue;
         }
         
-        if (found) {
-            for (uint32 j = 0; j < count; j++) {
-                pmm_set_bit(i + j);
-            }
-            used_blocks += count;
-            return i * PMM_BLOCK_SIZE;
+        char str[20];
+        printf("Zone ");
+        printf(zone->name);
+        printf(": ");
+        int_to_ascii((uint64)zone->free_blocks * PMM_BLOCK_SIZE / 1024, str);
+        printf(str);
+        printf(" / ");
+        int_to_ascii((uint64)zone->managed_blocks * PMM_BLOCK_SIZE / 1024, str);
+        printf(str);
+        printf(" KB free, reserve ");
+        int_to_ascii((uint64)zone->watermark * PMM_BLOCK_SIZE / 1024, str);
+        printf(str);
+        printf(" KB\n");
+        
+        printf("  Free Blocks by Order:");
+        for (uint32 k = 0; k <= PMM_MAX_ORDER; k++) {
+            printf(" ");
+            int_to_ascii(zone->free_count[k], str);
+            printf(str);
         }
+        printf("\n");
     }
-    
-    return 0;
 }
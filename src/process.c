@@ -22,108 +22,581 @@
 #include "../include/util.h"
 #include "../include/timer.h"
 #include "../include/irq.h"
+#include "../include/pmm.h"
+#include "../include/system.h"
+#include "../include/smp.h"
 
 static process_t processes[MAX_PROCESSES];
-static uint32 current_pid = 0;
+static process_t idle_tasks[MAX_CPUS];
+static spinlock_t process_table_lock = SPINLOCK_INIT;
 static uint32 next_pid = 1;
 static int preemptive_enabled = 0;
 static sched_stats_t sched_stats;
 
-extern uint32 read_eip();
+static const uint32 fair_weights[PRIORITY_LEVELS] = {
+    0, 137, 172, 215, 268, 335, 419, 524, 655, 819, 1024,
+    1280, 1600, 2000, 2500, 3125, 3906, 4883, 6104, 7629, 9537
+};
+
+static inline cpu_run_queue_t* cpu_rq(uint32 cpu) {
+    return &smp_get_cpu(cpu)->rq;
+}
+
+static inline cpu_run_queue_t* this_rq() {
+    return &smp_this_cpu()->rq;
+}
+
+static cpu_run_queue_t* lock_task_rq(process_t* proc, uint64* flags) {
+    while (1) {
+        cpu_run_queue_t* rq = cpu_rq(proc->last_cpu);
+        *flags = spin_lock_irqsave(&rq->lock);
+        if (rq == cpu_rq(proc->last_cpu)) {
+            return rq;
+        }
+        spin_unlock_irqrestore(&rq->lock, *flags);
+    }
+}
+
+static void run_queue_init(run_queue_t* queue) {
+    for (int i = 0; i < PRIORITY_LEVELS; i++) {
+        queue->head[i] = 0;
+        queue->tail[i] = 0;
+    }
+    queue->bitmap = 0;
+    queue->count = 0;
+}
+
+static void cpu_rq_init(cpu_run_queue_t* rq, uint32 cpu) {
+    rq->lock.locked = 0;
+    run_queue_init(&rq->queues[0]);
+    run_queue_init(&rq->queues[1]);
+    rq->active = &rq->queues[0];
+    rq->expired = &rq->queues[1];
+    rq->fair.tasks.node = 0;
+    rq->fair.min_vruntime = 0;
+    rq->fair.total_weight = 0;
+    rq->fair.count = 0;
+    rq->current = 0;
+    rq->previous = 0;
+    rq->idle = 0;
+    rq->migrate = 0;
+    rq->cpu = cpu;
+    rq->nr_running = 0;
+    rq->need_resched = 0;
+}
+
+static void run_queue_push(run_queue_t* queue, process_t* proc) {
+    uint32 prio = proc->priority;
+    
+    proc->run_next = 0;
+    proc->run_prev = queue->tail[prio];
+    if (queue->tail[prio]) {
+        queue->tail[prio]->run_next = proc;
+    } else {
+        queue->head[prio] = proc;
+    }
+    queue->tail[prio] = proc;
+    
+    queue->bitmap |= 1u << prio;
+    queue->count++;
+    proc->run_queue = queue;
+}
+
+static void run_queue_remove(process_t* proc) {
+    run_queue_t* queue = proc->run_queue;
+    uint32 prio = proc->priority;
+    
+    if (proc->run_prev) {
+        proc->run_prev->run_next = proc->run_next;
+    } else {
+        queue->head[prio] = proc->run_next;
+    }
+    if (proc->run_next) {
+        proc->run_next->run_prev = proc->run_prev;
+    } else {
+        queue->tail[prio] = proc->run_prev;
+    }
+    
+    if (!queue->head[prio]) {
+        queue->bitmap &= ~(1u << prio);
+    }
+    queue->count--;
+    
+    proc->run_next = 0;
+    proc->run_prev = 0;
+    proc->run_queue = 0;
+}
+
+static void fair_enqueue(cpu_run_queue_t* rq, process_t* proc) {
+    rb_node_t** link = &rq->fair.tasks.node;
+    rb_node_t* parent = 0;
+    
+    while (*link) {
+        parent = *link;
+        if (proc->vruntime < rb_entry(parent, process_t, fair_node)->vruntime) {
+            link = &parent->left;
+        } else {
+            link = &parent->right;
+        }
+    }
+    
+    rb_link_node(&proc->fair_node, parent, link);
+    rb_insert_color(&proc->fair_node, &rq->fair.tasks);
+    
+    proc->fair_queued = 1;
+    rq->fair.total_weight += proc->weight;
+    rq->fair.count++;
+}
+
+static void fair_dequeue(cpu_run_queue_t* rq, process_t* proc) {
+    rb_erase(&proc->fair_node, &rq->fair.tasks);
+    
+    proc->fair_queued = 0;
+    rq->fair.total_weight -= proc->weight;
+    rq->fair.count--;
+}
+
+static void fair_update_min_vruntime(cpu_run_queue_t* rq) {
+    rb_node_t* node = rb_first(&rq->fair.tasks);
+    process_t* current = rq->current;
+    uint64 vruntime = rq->fair.min_vruntime;
+    int found = 0;
+    
+    if (current && current->policy == SCHED_POLICY_FAIR && current->state == PROCESS_STATE_RUNNING) {
+        vruntime = current->vruntime;
+        found = 1;
+    }
+    
+    if (node) {
+        uint64 leftmost = rb_entry(node, process_t, fair_node)->vruntime;
+        if (!found || leftmost < vruntime) {
+            vruntime = leftmost;
+        }
+        found = 1;
+    }
+    
+    if (found && vruntime > rq->fair.min_vruntime) {
+        rq->fair.min_vruntime = vruntime;
+    }
+}
+
+static void fair_place(cpu_run_queue_t* rq, process_t* proc, int waking) {
+    uint64 vruntime = rq->fair.min_vruntime;
+    
+    if (waking) {
+        vruntime = vruntime > FAIR_SLEEPER_CREDIT ? vruntime - FAIR_SLEEPER_CREDIT : 0;
+    }
+    
+    if (proc->vruntime < vruntime) {
+        proc->vruntime = vruntime;
+    }
+}
+
+static uint32 fair_slice(cpu_run_queue_t* rq, process_t* proc) {
+    uint64 running = rq->fair.count + 1;
+    uint64 period = FAIR_TARGET_LATENCY;
+    
+    if (running * FAIR_MIN_GRANULARITY > period) {
+        period = running * FAIR_MIN_GRANULARITY;
+    }
+    
+    uint64 slice = period * proc->weight / (rq->fair.total_weight + proc->weight);
+    return slice < FAIR_MIN_GRANULARITY ? FAIR_MIN_GRANULARITY : (uint32)slice;
+}
+
+static uint64 fair_lag(cpu_run_queue_t* rq, process_t* proc) {
+    int64 lag = (int64)(proc->vruntime - rq->fair.min_vruntime);
+    return lag > 0 ? (uint64)lag : 0;
+}
+
+static void fair_account(cpu_run_queue_t* rq, process_t* proc, uint32 ticks) {
+    proc->vruntime += ((uint64)ticks << FAIR_VRUNTIME_SHIFT) * FAIR_WEIGHT_DEFAULT / proc->weight;
+    fair_update_min_vruntime(rq);
+}
+
+static void enqueue_process(cpu_run_queue_t* rq, process_t* proc) {
+    if (proc->policy == SCHED_POLICY_IDLE) {
+        return;
+    }
+    
+    if (proc->policy == SCHED_POLICY_FAIR) {
+        fair_enqueue(rq, proc);
+    } else if (proc->quantum_used >= proc->time_slice) {
+        proc->quantum_used = 0;
+        run_queue_push(rq->expired, proc);
+    } else {
+        run_queue_push(rq->active, proc);
+    }
+    
+    proc->last_cpu = rq->cpu;
+    rq->nr_running++;
+}
+
+static void dequeue_process(cpu_run_queue_t* rq, process_t* proc) {
+    if (proc->fair_queued) {
+        fair_dequeue(rq, proc);
+    } else if (proc->run_queue) {
+        run_queue_remove(proc);
+    } else {
+        return;
+    }
+    
+    rq->nr_running--;
+}
+
+static process_t* pick_next_process(cpu_run_queue_t* rq) {
+    if (!rq->active->bitmap) {
+        run_queue_t* queue = rq->active;
+        rq->active = rq->expired;
+        rq->expired = queue;
+    }
+    
+    process_t* proc = 0;
+    
+    if (rq->active->bitmap) {
+        proc = rq->active->head[31 - __builtin_clz(rq->active->bitmap)];
+    } else {
+        rb_node_t* node = rb_first(&rq->fair.tasks);
+        if (node) {
+            proc = rb_entry(node, process_t, fair_node);
+        }
+    }
+    
+    if (proc) {
+        dequeue_process(rq, proc);
+    }
+    return proc;
+}
+
+static process_t* find_stealable(cpu_run_queue_t* rq, uint32 cpu) {
+    for (rb_node_t* node = rb_first(&rq->fair.tasks); node; node = rb_next(node)) {
+        process_t* proc = rb_entry(node, process_t, fair_node);
+        if (proc->cpu_affinity & (1u << cpu)) {
+            return proc;
+        }
+    }
+    
+    for (int q = 0; q < 2; q++) {
+        run_queue_t* queue = q ? rq->expired : rq->active;
+        for (int prio = MAX_PRIORITY; prio >= MIN_PRIORITY; prio--) {
+            for (process_t* proc = queue->head[prio]; proc; proc = proc->run_next) {
+                if (proc->cpu_affinity & (1u << cpu)) {
+                    return proc;
+                }
+            }
+        }
+    }
+    
+    return 0;
+}
+
+static process_t* steal_task(cpu_run_queue_t* rq) {
+    cpu_run_queue_t* busiest = 0;
+    uint32 online = smp_online_mask();
+    uint32 most = 0;
+    
+    for (uint32 cpu = 0; cpu < MAX_CPUS; cpu++) {
+        if (cpu == rq->cpu || !(online & (1u << cpu))) {
+            continue;
+        }
+        cpu_run_queue_t* other = cpu_rq(cpu);
+        if (other->nr_running > most) {
+            most = other->nr_running;
+            busiest = other;
+        }
+    }
+    
+    if (!busiest || !spin_trylock(&busiest->lock)) {
+        return 0;
+    }
+    
+    process_t* proc = find_stealable(busiest, rq->cpu);
+    if (proc) {
+        dequeue_process(busiest, proc);
+        if (proc->policy == SCHED_POLICY_FAIR) {
+            proc->vruntime = rq->fair.min_vruntime + fair_lag(busiest, proc);
+        }
+        proc->last_cpu = rq->cpu;
+        sched_stats.migrations++;
+    }
+    
+    spin_unlock(&busiest->lock);
+    return proc;
+}
+
+static uint32 select_cpu(process_t* proc) {
+    uint32 allowed = proc->cpu_affinity & smp_online_mask();
+    uint32 best = 0;
+    uint32 best_load = 0xFFFFFFFF;
+    
+    if (!allowed) {
+        return 0;
+    }
+    
+    if (allowed & (1u << proc->last_cpu)) {
+        best = proc->last_cpu;
+        best_load = cpu_rq(best)->nr_running;
+    }
+    
+    for (uint32 cpu = 0; cpu < MAX_CPUS; cpu++) {
+        if ((allowed & (1u << cpu)) && cpu_rq(cpu)->nr_running < best_load) {
+            best = cpu;
+            best_load = cpu_rq(cpu)->nr_running;
+        }
+    }
+    
+    return best;
+}
+
+static int wakeup_preempts(cpu_run_queue_t* rq, process_t* proc) {
+    process_t* current = rq->current;
+    
+    if (!current || current->state != PROCESS_STATE_RUNNING || current->policy == SCHED_POLICY_IDLE) {
+        return 1;
+    }
+    
+    if (proc->policy == SCHED_POLICY_PRIORITY) {
+        return current->policy == SCHED_POLICY_FAIR || proc->priority > current->priority;
+    }
+    
+    if (current->policy == SCHED_POLICY_PRIORITY) {
+        return 0;
+    }
+    
+    return proc->vruntime + FAIR_WAKEUP_GRANULARITY < current->vruntime;
+}
+
+static void activate_process(process_t* proc, uint32 from_state, int waking) {
+    uint64 flags;
+    cpu_run_queue_t* rq = lock_task_rq(proc, &flags);
+    
+    if (proc->state != from_state) {
+        spin_unlock_irqrestore(&rq->lock, flags);
+        return;
+    }
+    
+    uint32 cpu = select_cpu(proc);
+    if (cpu != rq->cpu) {
+        uint64 lag = fair_lag(rq, proc);
+        proc->last_cpu = cpu;
+        spin_unlock(&rq->lock);
+        rq = cpu_rq(cpu);
+        spin_lock(&rq->lock);
+        if (proc->state != from_state || proc->last_cpu != cpu) {
+            spin_unlock_irqrestore(&rq->lock, flags);
+            return;
+        }
+        if (proc->policy == SCHED_POLICY_FAIR) {
+            proc->vruntime = rq->fair.min_vruntime + lag;
+        }
+    }
+    
+    proc->state = PROCESS_STATE_READY;
+    if (proc->policy == SCHED_POLICY_FAIR) {
+        fair_place(rq, proc, waking);
+    }
+    enqueue_process(rq, proc);
+    
+    if (wakeup_preempts(rq, proc)) {
+        rq->need_resched = 1;
+    }
+    
+    spin_unlock_irqrestore(&rq->lock, flags);
+}
+
+static void process_wake(void* data) {
+    activate_process((process_t*)data, PROCESS_STATE_SLEEPING, 1);
+}
+
+static void process_init_slot(process_t* proc) {
+    proc->state = PROCESS_STATE_TERMINATED;
+    proc->pid = 0;
+    proc->ppid = 0;
+    proc->priority = DEFAULT_PRIORITY;
+    proc->time_slice = DEFAULT_TIME_SLICE;
+    proc->quantum_used = 0;
+    proc->total_time = 0;
+    proc->stack = 0;
+    proc->kernel_rsp = 0;
+    proc->page_directory = 0;
+    proc->run_next = 0;
+    proc->run_prev = 0;
+    proc->run_queue = 0;
+    proc->sleep_timer.slot = 0;
+    proc->policy = SCHED_POLICY_FAIR;
+    proc->weight = fair_weights[DEFAULT_PRIORITY];
+    proc->vruntime = 0;
+    proc->fair_queued = 0;
+    proc->last_cpu = 0;
+    proc->cpu_affinity = CPU_ALL_MASK;
+}
+
+static process_t* process_alloc_slot() {
+    uint64 flags = spin_lock_irqsave(&process_table_lock);
+    
+    for (int i = 0; i < MAX_PROCESSES; i++) {
+        if (processes[i].state == PROCESS_STATE_TERMINATED) {
+            process_init_slot(&processes[i]);
+            processes[i].pid = next_pid++;
+            processes[i].state = PROCESS_STATE_BLOCKED;
+            spin_unlock_irqrestore(&process_table_lock, flags);
+            return &processes[i];
+        }
+    }
+    
+    spin_unlock_irqrestore(&process_table_lock, flags);
+    return 0;
+}
+
+static int process_init_stack(process_t* proc, void (*entry_point)()) {
+    proc->stack_size = PROCESS_STACK_SIZE;
+    proc->stack = (uint64*)(uintptr)pmm_allocate_pages_flags(PROCESS_STACK_PAGES, PMM_ALLOC_ZERO);
+    
+    if (!proc->stack) {
+        return -1;
+    }
+    
+    uint64* sp = proc->stack + PROCESS_STACK_SIZE / sizeof(uint64);
+    *--sp = (uintptr)process_start;
+    *--sp = 0x002;
+    *--sp = 0;
+    *--sp = 0;
+    *--sp = (uintptr)entry_point;
+    *--sp = 0;
+    *--sp = 0;
+    *--sp = 0;
+    
+    proc->kernel_rsp = (uintptr)sp;
+    return 0;
+}
+
+static void idle_task_init(process_t* idle, uint32 cpu) {
+    process_init_slot(idle);
+    idle->policy = SCHED_POLICY_IDLE;
+    idle->priority = MIN_PRIORITY;
+    idle->state = PROCESS_STATE_RUNNING;
+    idle->last_cpu = cpu;
+    idle->cpu_affinity = 1u << cpu;
+    strcpy(idle->name, "idle");
+    
+    char cpu_str[10];
+    int_to_ascii(cpu, cpu_str);
+    strcpy(idle->name + 4, cpu_str);
+    
+    cpu_rq(cpu)->idle = idle;
+}
 
 void init_process_manager() {
     for (int i = 0; i < MAX_PROCESSES; i++) {
-        processes[i].state = PROCESS_STATE_TERMINATED;
-        processes[i].pid = 0;
-        processes[i].ppid = 0;
-        processes[i].priority = DEFAULT_PRIORITY;
-        processes[i].time_slice = DEFAULT_TIME_SLICE;
-        processes[i].quantum_used = 0;
-        processes[i].total_time = 0;
-        processes[i].stack = 0;
-        processes[i].page_directory = 0;
+        process_init_slot(&processes[i]);
+    }
+    
+    for (uint32 cpu = 0; cpu < MAX_CPUS; cpu++) {
+        cpu_rq_init(cpu_rq(cpu), cpu);
     }
     
     processes[0].pid = 0;
     processes[0].ppid = 0;
     processes[0].state = PROCESS_STATE_RUNNING;
     processes[0].priority = MAX_PRIORITY;
+    processes[0].weight = fair_weights[MAX_PRIORITY];
     processes[0].time_slice = DEFAULT_TIME_SLICE * 2;
     processes[0].stack = 0;
+    processes[0].cpu_affinity = 1u << 0;
     strcpy(processes[0].name, "kernel");
     
+    cpu_rq(0)->current = &processes[0];
+    
+    idle_task_init(&idle_tasks[0], 0);
+    process_init_stack(&idle_tasks[0], sched_idle_loop);
+    
     sched_stats.context_switches = 0;
     sched_stats.processes_created = 1;
     sched_stats.processes_terminated = 0;
     sched_stats.total_scheduler_time = 0;
+    sched_stats.migrations = 0;
 }
 
 uint32 create_process(void (*entry_point)(), const char* name, uint32 priority) {
-    for (int i = 0; i < MAX_PROCESSES; i++) {
-        if (processes[i].state == PROCESS_STATE_TERMINATED) {
-            processes[i].pid = next_pid++;
-            processes[i].ppid = current_pid;
-            processes[i].state = PROCESS_STATE_READY;
-            
-            if (priority < MIN_PRIORITY) priority = MIN_PRIORITY;
-            if (priority > MAX_PRIORITY) priority = MAX_PRIORITY;
-            processes[i].priority = priority;
-            
-            processes[i].time_slice = DEFAULT_TIME_SLICE + (priority / 2);
-            processes[i].quantum_used = 0;
-            processes[i].total_time = 0;
-            
-            processes[i].stack_size = PROCESS_STACK_SIZE;
-            processes[i].stack = (uint32*)kmalloc(PROCESS_STACK_SIZE);
-            
-            if (!processes[i].stack) {
-                return 0;
-            }
-            
-            memset(processes[i].stack, 0, PROCESS_STACK_SIZE);
-            
-            processes[i].cpu.eip = (uintptr)entry_point;
-            processes[i].cpu.esp = (uintptr)processes[i].stack + PROCESS_STACK_SIZE - 4;
-            processes[i].cpu.ebp = processes[i].cpu.esp;
-            processes[i].cpu.eflags = 0x202;
-            processes[i].cpu.cs = 0x08;
-            processes[i].cpu.ds = 0x10;
-            processes[i].cpu.es = 0x10;
-            processes[i].cpu.fs = 0x10;
-            processes[i].cpu.gs = 0x10;
-            processes[i].cpu.ss = 0x10;
-            
-            processes[i].page_directory = 0;
-            
-            strcpy(processes[i].name, name);
-            
-            sched_stats.processes_created++;
-            
-            return processes[i].pid;
+    process_t* proc = process_alloc_slot();
+    if (!proc) {
+        return 0;
+    }
+    
+    proc->ppid = get_current_process()->pid;
+    
+    if (priority < MIN_PRIORITY) priority = MIN_PRIORITY;
+    if (priority > MAX_PRIORITY) priority = MAX_PRIORITY;
+    proc->priority = priority;
+    proc->weight = fair_weights[priority];
+    proc->time_slice = DEFAULT_TIME_SLICE + (priority / 2);
+    
+    if (process_init_stack(proc, entry_point) != 0) {
+        proc->state = PROCESS_STATE_TERMINATED;
+        return 0;
+    }
+    
+    strcpy(proc->name, name);
+    
+    sched_stats.processes_created++;
+    
+    uint32 pid = proc->pid;
+    activate_process(proc, PROCESS_STATE_BLOCKED, 0);
+    return pid;
+}
+
+void sched_init_cpu(uint32 cpu) {
+    idle_task_init(&idle_tasks[cpu], cpu);
+    cpu_rq(cpu)->current = &idle_tasks[cpu];
+}
+
+void sched_idle_loop() {
+    while (1) {
+        if (!pmm_refill_zero_pool()) {
+            __asm__ __volatile__("hlt");
         }
     }
-    return 0;
 }
 
+static void schedule_locked(cpu_run_queue_t* rq);
+
 void terminate_process(uint32 pid) {
-    for (int i = 0; i < MAX_PROCESSES; i++) {
-        if (processes[i].pid == pid) {
-            if (processes[i].stack) {
-                kfree(processes[i].stack);
-                processes[i].stack = 0;
-            }
-            
-            processes[i].state = PROCESS_STATE_ZOMBIE;
-            processes[i].exit_code = 0;
-            
-            sched_stats.processes_terminated++;
-            
-            if (pid == current_pid) {
-                schedule();
-            }
+    process_t* proc = get_process_by_pid(pid);
+    if (!proc || proc->state == PROCESS_STATE_ZOMBIE || proc->policy == SCHED_POLICY_IDLE) {
+        return;
+    }
+    
+    uint64 flags;
+    cpu_run_queue_t* rq = lock_task_rq(proc, &flags);
+    
+    if (proc->state == PROCESS_STATE_READY) {
+        dequeue_process(rq, proc);
+    } else if (proc->state == PROCESS_STATE_SLEEPING) {
+        timer_cancel(&proc->sleep_timer);
+    }
+    
+    int running = proc->state == PROCESS_STATE_RUNNING;
+    
+    proc->state = PROCESS_STATE_ZOMBIE;
+    proc->exit_code = 0;
+    
+    if (!running && proc->stack) {
+        pmm_free_pages((uintptr)proc->stack, PROCESS_STACK_PAGES);
+        proc->stack = 0;
+    }
+    
+    sched_stats.processes_terminated++;
+    
+    if (proc == rq->current) {
+        if (rq == this_rq()) {
+            schedule_locked(rq);
+            irq_restore(flags);
             return;
         }
+        rq->need_resched = 1;
     }
+    
+    spin_unlock_irqrestore(&rq->lock, flags);
 }
 
 void exit_process(uint32 exit_code) {
@@ -137,85 +610,148 @@ void yield_cpu() {
 }
 
 void sleep_process(uint32 ticks) {
-    process_t* proc = get_current_process();
+    uint64 flags = irq_save();
+    cpu_run_queue_t* rq = this_rq();
+    spin_lock(&rq->lock);
+    
+    process_t* proc = rq->current;
     proc->state = PROCESS_STATE_SLEEPING;
     proc->sleep_until = get_tick_count() + ticks;
-    schedule();
+    timer_add(&proc->sleep_timer, proc->sleep_until, process_wake, proc);
+    
+    schedule_locked(rq);
+    irq_restore(flags);
 }
 
-static process_t* find_next_ready_process() {
-    uint32 highest_priority = 0;
-    int32 best_candidate = -1;
+static void finish_switch() {
+    cpu_run_queue_t* rq = this_rq();
+    process_t* prev = rq->previous;
+    process_t* migrate = rq->migrate;
     
-    for (int i = 0; i < MAX_PROCESSES; i++) {
-        if (processes[i].state == PROCESS_STATE_SLEEPING) {
-            if (get_tick_count() >= processes[i].sleep_until) {
-                processes[i].state = PROCESS_STATE_READY;
-            }
-        }
-        
-        if (processes[i].state == PROCESS_STATE_READY) {
-            uint32 effective_priority = processes[i].priority;
-            
-            if (processes[i].quantum_used > 0) {
-                effective_priority = effective_priority * processes[i].time_slice / 
-                                   (processes[i].time_slice + processes[i].quantum_used);
-            }
-            
-            if (effective_priority > highest_priority) {
-                highest_priority = effective_priority;
-                best_candidate = i;
-            }
-        }
+    rq->previous = 0;
+    rq->migrate = 0;
+    spin_unlock(&rq->lock);
+    
+    if (prev && prev->state == PROCESS_STATE_ZOMBIE && prev->stack) {
+        pmm_free_pages((uintptr)prev->stack, PROCESS_STACK_PAGES);
+        prev->stack = 0;
     }
     
-    if (best_candidate >= 0) {
-        return &processes[best_candidate];
+    if (migrate) {
+        activate_process(migrate, PROCESS_STATE_MIGRATING, 0);
     }
+}
+
+void switch_to_process(process_t* next) {
+    cpu_run_queue_t* rq = this_rq();
+    process_t* prev = rq->current;
+    
+    rq->previous = prev;
+    rq->current = next;
+    next->last_cpu = rq->cpu;
     
-    return &processes[0];
+    switch_context(&prev->kernel_rsp, next->kernel_rsp);
+    finish_switch();
 }
 
-void schedule() {
-    if (!preemptive_enabled && current_pid != 0) {
-        return;
+void process_bootstrap(void (*entry_point)()) {
+    finish_switch();
+    __asm__ __volatile__("sti");
+    
+    entry_point();
+    exit_process(0);
+}
+
+static void schedule_locked(cpu_run_queue_t* rq) {
+    process_t* current = rq->current;
+    int runnable = current->state == PROCESS_STATE_RUNNING && current->policy != SCHED_POLICY_IDLE;
+    
+    rq->need_resched = 0;
+    process_t* next = pick_next_process(rq);
+    
+    if (!next && !runnable) {
+        next = steal_task(rq);
     }
     
-    process_t* current = &processes[current_pid];
-    process_t* next = find_next_ready_process();
+    if (!next) {
+        if (runnable) {
+            if (current->quantum_used >= current->time_slice) {
+                current->quantum_used = 0;
+                if (current->policy == SCHED_POLICY_FAIR) {
+                    current->time_slice = fair_slice(rq, current);
+                }
+            }
+            spin_unlock(&rq->lock);
+            return;
+        }
+        next = rq->idle;
+    }
     
-    if (next == current && current->state == PROCESS_STATE_RUNNING) {
-        current->quantum_used++;
+    if (next == current) {
+        current->state = PROCESS_STATE_RUNNING;
+        spin_unlock(&rq->lock);
         return;
     }
     
     if (current->state == PROCESS_STATE_RUNNING) {
         current->state = PROCESS_STATE_READY;
-    }
-    
-    if (current->quantum_used >= current->time_slice) {
-        current->quantum_used = 0;
+        if (current->policy == SCHED_POLICY_IDLE) {
+            current->state = PROCESS_STATE_RUNNING;
+        } else if (current->cpu_affinity & (1u << rq->cpu)) {
+            enqueue_process(rq, current);
+        } else {
+            current->state = PROCESS_STATE_MIGRATING;
+            rq->migrate = current;
+        }
     }
     
     next->state = PROCESS_STATE_RUNNING;
-    next->quantum_used = 0;
-    current_pid = next->pid;
+    if (next->policy == SCHED_POLICY_FAIR) {
+        next->time_slice = fair_slice(rq, next);
+        next->quantum_used = 0;
+    }
     
     sched_stats.context_switches++;
+    
+    switch_to_process(next);
+}
+
+void schedule() {
+    uint64 flags = irq_save();
+    cpu_run_queue_t* rq = this_rq();
+    spin_lock(&rq->lock);
+    schedule_locked(rq);
+    irq_restore(flags);
 }
 
 void schedule_irq() {
-    process_t* current = get_current_process();
+    cpu_run_queue_t* rq = this_rq();
+    spin_lock(&rq->lock);
+    
+    process_t* current = rq->current;
     current->quantum_used++;
     current->total_time++;
     
-    if (current->quantum_used >= current->time_slice) {
-        schedule();
+    if (current->policy == SCHED_POLICY_FAIR) {
+        fair_account(rq, current, 1);
     }
+    
+    int forced = current->policy == SCHED_POLICY_IDLE || current->state != PROCESS_STATE_RUNNING ||
+                 !(current->cpu_affinity & (1u << rq->cpu));
+    
+    if (forced || (preemptive_enabled && (rq->need_resched || current->quantum_used >= current->time_slice))) {
+        schedule_locked(rq);
+        return;
+    }
+    
+    spin_unlock(&rq->lock);
 }
 
 process_t* get_current_process() {
-    return &processes[current_pid];
+    uint64 flags = irq_save();
+    process_t* proc = this_rq()->current;
+    irq_restore(flags);
+    return proc;
 }
 
 process_t* get_process_by_pid(uint32 pid) {
@@ -227,31 +763,118 @@ process_t* get_process_by_pid(uint32 pid) {
     return 0;
 }
 
+static void requeue_process(process_t* proc, uint32 priority, uint32 policy) {
+    uint64 flags;
+    cpu_run_queue_t* rq = lock_task_rq(proc, &flags);
+    
+    int queued = proc->run_queue || proc->fair_queued;
+    if (queued) {
+        dequeue_process(rq, proc);
+    }
+    
+    if (policy != proc->policy) {
+        proc->policy = policy;
+        proc->quantum_used = 0;
+        if (policy == SCHED_POLICY_FAIR) {
+            fair_place(rq, proc, 0);
+        }
+    }
+    
+    proc->priority = priority;
+    proc->weight = fair_weights[priority];
+    if (proc->policy == SCHED_POLICY_PRIORITY) {
+        proc->time_slice = DEFAULT_TIME_SLICE + (priority / 2);
+    }
+    
+    if (queued) {
+        enqueue_process(rq, proc);
+    }
+    
+    spin_unlock_irqrestore(&rq->lock, flags);
+}
+
 void set_process_priority(uint32 pid, uint32 priority) {
     process_t* proc = get_process_by_pid(pid);
-    if (proc) {
+    if (proc && proc->policy != SCHED_POLICY_IDLE) {
         if (priority < MIN_PRIORITY) priority = MIN_PRIORITY;
         if (priority > MAX_PRIORITY) priority = MAX_PRIORITY;
-        proc->priority = priority;
-        proc->time_slice = DEFAULT_TIME_SLICE + (priority / 2);
+        requeue_process(proc, priority, proc->policy);
     }
 }
 
 void block_process(uint32 pid) {
     process_t* proc = get_process_by_pid(pid);
-    if (proc) {
-        proc->state = PROCESS_STATE_BLOCKED;
-        if (pid == current_pid) {
-            schedule();
+    if (!proc || proc->policy == SCHED_POLICY_IDLE) {
+        return;
+    }
+    
+    uint64 flags;
+    cpu_run_queue_t* rq = lock_task_rq(proc, &flags);
+    
+    if (proc->state == PROCESS_STATE_READY) {
+        dequeue_process(rq, proc);
+    } else if (proc->state == PROCESS_STATE_SLEEPING) {
+        timer_cancel(&proc->sleep_timer);
+    } else if (proc->state != PROCESS_STATE_RUNNING && proc->state != PROCESS_STATE_MIGRATING) {
+        spin_unlock_irqrestore(&rq->lock, flags);
+        return;
+    }
+    
+    proc->state = PROCESS_STATE_BLOCKED;
+    
+    if (proc == rq->current) {
+        if (rq == this_rq()) {
+            schedule_locked(rq);
+            irq_restore(flags);
+            return;
         }
+        rq->need_resched = 1;
     }
+    
+    spin_unlock_irqrestore(&rq->lock, flags);
 }
 
 void unblock_process(uint32 pid) {
     process_t* proc = get_process_by_pid(pid);
-    if (proc && proc->state == PROCESS_STATE_BLOCKED) {
-        proc->state = PROCESS_STATE_READY;
+    if (proc) {
+        activate_process(proc, PROCESS_STATE_BLOCKED, 1);
+    }
+}
+
+void set_process_policy(uint32 pid, uint32 policy) {
+    process_t* proc = get_process_by_pid(pid);
+    if (!proc || (policy != SCHED_POLICY_FAIR && policy != SCHED_POLICY_PRIORITY) || proc->policy == policy ||
+        proc->policy == SCHED_POLICY_IDLE) {
+        return;
+    }
+    
+    requeue_process(proc, proc->priority, policy);
+}
+
+void set_process_affinity(uint32 pid, uint32 mask) {
+    process_t* proc = get_process_by_pid(pid);
+    if (!proc || proc->policy == SCHED_POLICY_IDLE || !(mask & smp_online_mask())) {
+        return;
+    }
+    
+    uint64 flags;
+    cpu_run_queue_t* rq = lock_task_rq(proc, &flags);
+    
+    proc->cpu_affinity = mask;
+    
+    if (proc->state == PROCESS_STATE_READY && !(mask & (1u << rq->cpu))) {
+        dequeue_process(rq, proc);
+        proc->state = PROCESS_STATE_MIGRATING;
+        spin_unlock_irqrestore(&rq->lock, flags);
+        activate_process(proc, PROCESS_STATE_MIGRATING, 0);
+        return;
     }
+    
+    if (proc == rq->current && !(mask & (1u << rq->cpu))) {
+        rq->need_resched = 1;
+    }
+    
+    spin_unlock_irqrestore(&rq->lock, flags);
 }
 
 void enable_preemptive_scheduling() {
@@ -262,46 +885,63 @@ void disable_preemptive_scheduling() {
     preemptive_enabled = 0;
 }
 
+static void list_process(process_t* proc) {
+    char pid_str[10];
+    int_to_ascii(proc->pid, pid_str);
+    printf(pid_str);
+    printf("    ");
+    
+    char ppid_str[10];
+    int_to_ascii(proc->ppid, ppid_str);
+    printf(ppid_str);
+    printf("    ");
+    
+    if (proc->state == PROCESS_STATE_RUNNING) {
+        printf("RUNNING   ");
+    } else if (proc->state == PROCESS_STATE_READY) {
+        printf("READY     ");
+    } else if (proc->state == PROCESS_STATE_BLOCKED) {
+        printf("BLOCKED   ");
+    } else if (proc->state == PROCESS_STATE_SLEEPING) {
+        printf("SLEEPING  ");
+    } else if (proc->state == PROCESS_STATE_ZOMBIE) {
+        printf("ZOMBIE    ");
+    } else if (proc->state == PROCESS_STATE_MIGRATING) {
+        printf("MIGRATING ");
+    }
+    
+    char prio_str[10];
+    int_to_ascii(proc->priority, prio_str);
+    printf(prio_str);
+    printf("   ");
+    
+    char slice_str[10];
+    int_to_ascii(proc->time_slice, slice_str);
+    printf(slice_str);
+    printf("     ");
+    
+    char cpu_str[10];
+    int_to_ascii(proc->last_cpu, cpu_str);
+    printf(cpu_str);
+    printf("   ");
+    
+    printf(proc->name);
+    printf("\n");
+}
+
 void list_processes() {
-    printf("PID  PPID State     Pri Slice Name\n");
-    printf("---  ---- --------- --- ----- ----\n");
+    printf("PID  PPID State     Pri Slice CPU Name\n");
+    printf("---  ---- --------- --- ----- --- ----\n");
     
     for (int i = 0; i < MAX_PROCESSES; i++) {
         if (processes[i].state != PROCESS_STATE_TERMINATED) {
-            char pid_str[10];
-            int_to_ascii(processes[i].pid, pid_str);
-            printf(pid_str);
-            printf("    ");
-            
-            char ppid_str[10];
-            int_to_ascii(processes[i].ppid, ppid_str);
-            printf(ppid_str);
-            printf("    ");
-            
-            if (processes[i].state == PROCESS_STATE_RUNNING) {
-                printf("RUNNING   ");
-            } else if (processes[i].state == PROCESS_STATE_READY) {
-                printf("READY     ");
-            } else if (processes[i].state == PROCESS_STATE_BLOCKED) {
-                printf("BLOCKED   ");
-            } else if (processes[i].state == PROCESS_STATE_SLEEPING) {
-                printf("SLEEPING  ");
-            } else if (processes[i].state == PROCESS_STATE_ZOMBIE) {
-                printf("ZOMBIE    ");
-            }
-            
-            char prio_str[10];
-            int_to_ascii(processes[i].priority, prio_str);
-            printf(prio_str);
-            printf("   ");
-            
-            char slice_str[10];
-            int_to_ascii(processes[i].time_slice, slice_str);
-            printf(slice_str);
-            printf("     ");
-            
-            printf(processes[i].name);
-            printf("\n");
+            list_process(&processes[i]);
+        }
+    }
+    
+    for (uint32 cpu = 0; cpu < MAX_CPUS; cpu++) {
+        if (cpu_rq(cpu)->idle) {
+            list_process(cpu_rq(cpu)->idle);
         }
     }
 }
@@ -329,4 +969,10 @@ void print_scheduler_stats() {
     int_to_ascii(sched_stats.processes_terminated, term_str);
     printf(term_str);
     printf("\n");
+    
+    printf("Migrations: ");
+    char migrate_str[20];
+    int_to_ascii(sched_stats.migrations, migrate_str);
+    printf(migrate_str);
+    printf("\n");
 }
@@ -0,0 +1,288 @@
+/*
+ * DaOS - Simple Operating System
+ * Copyright (C) 2025 Mostafizur Rahman
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "../include/rbtree.h"
+
+static void rb_rotate_left(rb_node_t* node, rb_root_t* root) {
+    rb_node_t* right = node->right;
+    
+    node->right = right->left;
+    if (right->left) {
+        right->left->parent = node;
+    }
+    
+    right->parent = node->parent;
+    if (!node->parent) {
+        root->node = right;
+    } else if (node == node->parent->left) {
+        node->parent->left = right;
+    } else {
+        node->parent->right = right;
+    }
+    
+    right->left = node;
+    node->parent = right;
+}
+
+static void rb_rotate_right(rb_node_t* node, rb_root_t* root) {
+    rb_node_t* left = node->left;
+    
+    node->left = left->right;
+    if (left->right) {
+        left->right->parent = node;
+    }
+    
+    left->parent = node->parent;
+    if (!node->parent) {
+        root->node = left;
+    } else if (node == node->parent->right) {
+        node->parent->right = left;
+    } else {
+        node->parent->left = left;
+    }
+    
+    left->right = node;
+    node->parent = left;
+}
+
+void rb_link_node(rb_node_t* node, rb_node_t* parent, rb_node_t** link) {
+    node->parent = parent;
+    node->left = 0;
+    node->right = 0;
+    node->color = RB_RED;
+    *link = node;
+}
+
+void rb_insert_color(rb_node_t* node, rb_root_t* root) {
+    rb_node_t* parent;
+    
+    while ((parent = node->parent) && parent->color == RB_RED) {
+        rb_node_t* grandparent = parent->parent;
+        
+        if (parent == grandparent->left) {
+            rb_node_t* uncle = grandparent->right;
+            if (uncle && uncle->color == RB_RED) {
+                uncle->color = RB_BLACK;
+                parent->color = RB_BLACK;
+                grandparent->color = RB_RED;
+                node = grandparent;
+                continue;
+            }
+            if (node == parent->right) {
+                rb_rotate_left(parent, root);
+                node = parent;
+                parent = node->parent;
+            }
+            parent->color = RB_BLACK;
+            grandparent->color = RB_RED;
+            rb_rotate_right(grandparent, root);
+        } else {
+            rb_node_t* uncle = grandparent->left;
+            if (uncle && uncle->color == RB_RED) {
+                uncle->color = RB_BLACK;
+                parent->color = RB_BLACK;
+                grandparent->color = RB_RED;
+                node = grandparent;
+                continue;
+            }
+            if (node == parent->left) {
+                rb_rotate_right(parent, root);
+                node = parent;
+                parent = node->parent;
+            }
+            parent->color = RB_BLACK;
+            grandparent->color = RB_RED;
+            rb_rotate_left(grandparent, root);
+        }
+    }
+    
+    root->node->color = RB_BLACK;
+}
+
+static void rb_replace_child(rb_node_t* parent, rb_node_t* old, rb_node_t* new, rb_root_t* root) {
+    if (!parent) {
+        root->node = new;
+    } else if (parent->left == old) {
+        parent->left = new;
+    } else {
+        parent->right = new;
+    }
+}
+
+static void rb_erase_color(rb_node_t* node, rb_node_t* parent, rb_root_t* root) {
+    while (node != root->node && (!node || node->color == RB_BLACK)) {
+        if (node == parent->left) {
+            rb_node_t* sibling = parent->right;
+            if (sibling->color == RB_RED) {
+                sibling->color = RB_BLACK;
+                parent->color = RB_RED;
+                rb_rotate_left(parent, root);
+                sibling = parent->right;
+            }
+            if ((!sibling->left || sibling->left->color == RB_BLACK) &&
+                (!sibling->right || sibling->right->color == RB_BLACK)) {
+                sibling->color = RB_RED;
+                node = parent;
+                parent = node->parent;
+                continue;
+            }
+            if (!sibling->right || sibling->right->color == RB_BLACK) {
+                sibling->left->color = RB_BLACK;
+                sibling->color = RB_RED;
+                rb_rotate_right(sibling, root);
+                sibling = parent->right;
+            }
+            sibling->color = parent->color;
+            parent->color = RB_BLACK;
+            sibling->right->color = RB_BLACK;
+            rb_rotate_left(parent, root);
+            node = root->node;
+            break;
+        } else {
+            rb_node_t* sibling = parent->left;
+            if (sibling->color == RB_RED) {
+                sibling->color = RB_BLACK;
+                parent->color = RB_RED;
+                rb_rotate_right(parent, root);
+                sibling = parent->left;
+            }
+            if ((!sibling->left || sibling->left->color == RB_BLACK) &&
+                (!sibling->right || sibling->right->color == RB_BLACK)) {
+                sibling->color = RB_RED;
+                node = parent;
+                parent = node->parent;
+                continue;
+            }
+            if (!sibling->left || sibling->left->color == RB_BLACK) {
+                sibling->right->color = RB_BLACK;
+                sibling->color = RB_RED;
+                rb_rotate_left(sibling, root);
+                sibling = parent->left;
+            }
+            sibling->color = parent->color;
+            parent->color = RB_BLACK;
+            sibling->left->color = RB_BLACK;
+            rb_rotate_right(parent, root);
+            node = root->node;
+            break;
+        }
+    }
+    
+    if (node) {
+        node->color = RB_BLACK;
+    }
+}
+
+void rb_erase(rb_node_t* node, rb_root_t* root) {
+    rb_node_t* child;
+    rb_node_t* parent;
+    int color;
+    
+    if (!node->left || !node->right) {
+        child = node->left ? node->left : node->right;
+        parent = node->parent;
+        color = node->color;
+        
+        if (child) {
+            child->parent = parent;
+        }
+        rb_replace_child(parent, node, child, root);
+    } else {
+        rb_node_t* successor = node->right;
+        while (successor->left) {
+            successor = successor->left;
+        }
+        
+        child = successor->right;
+        parent = successor->parent;
+        color = successor->color;
+        
+        if (parent == node) {
+            parent = successor;
+        } else {
+            if (child) {
+                child->parent = parent;
+            }
+            parent->left = child;
+            successor->right = node->right;
+            node->right->parent = successor;
+        }
+        
+        successor->parent = node->parent;
+        successor->left = node->left;
+        successor->color = node->color;
+        node->left->parent = successor;
+        rb_replace_child(node->parent, node, successor, root);
+    }
+    
+    if (color == RB_BLACK) {
+        rb_erase_color(child, parent, root);
+    }
+}
+
+rb_node_t* rb_first(rb_root_t* root) {
+    rb_node_t* node = root->node;
+    if (!node) {
+        return 0;
+    }
+    while (node->left) {
+        node = node->left;
+    }
+    return node;
+}
+
+rb_node_t* rb_last(rb_root_t* root) {
+    rb_node_t* node = root->node;
+    if (!node) {
+        return 0;
+    }
+    while (node->right) {
+        node = node->right;
+    }
+    return node;
+}
+
+rb_node_t* rb_next(rb_node_t* node) {
+    if (node->right) {
+        node = node->right;
+        while (node->left) {
+            node = node->left;
+        }
+        return node;
+    }
+    
+    while (node->parent && node == node->parent->right) {
+        node = node->parent;
+    }
+    return node->parent;
+}
+
+rb_node_t* rb_prev(rb_node_t* node) {
+    if (node->left) {
+        node = node->left;
+        while (node->right) {
+            node = node->right;
+        }
+        return node;
+    }
+    
+    while (node->parent && node == node->parent->left) {
+        node = node->parent;
+    }
+    return node->parent;
+}
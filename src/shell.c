@@ -19,8 +19,10 @@
 #include "../include/shell.h"
 #include "../include/snake.h"
 #include "../include/memory.h"
+#include "../include/heapprof.h"
 #include "../include/fs.h"
 #include "../include/process.h"
+#include "../include/smp.h"
 #include "../include/timer.h"
 #include "../include/hal.h"
 #include "../include/ext2.h"
@@ -29,6 +31,8 @@
 #include "../include/dma.h"
 
 void launch_shell(int n) {
+    arena_mark_t scratch_mark = arena_mark(get_scratch_arena());
+    
     set_screen_color(0x0A, 0x00);
     printf("DaOS> ");
     set_screen_color(0x07, 0x00);
@@ -45,7 +49,10 @@ void launch_shell(int n) {
         printf("  clear - Clear the screen\n");
         printf("  uptime - Show system uptime\n");
         printf("  memstat - Show memory statistics\n");
+        printf("  heapprof [on|off|reset] - Heap allocation profile\n");
+        printf("  heapmap [kb] - Show heap fragmentation map\n");
         printf("  ps - List all processes\n");
+        printf("  cpus - List processors\n");
         printf("  devices - List registered devices\n");
         printf("  disks - List disk drives\n");
         printf("Display:\n");
@@ -157,6 +164,21 @@ void launch_shell(int n) {
         play_snake();
     } else if (cmdEql(command, "memstat")) {
         print_memory_stats();
+    } else if (cmdEql(command, "heapmap")) {
+        print_heap_map(strlength(arg) > 0 ? str_to_int(arg) : 0);
+    } else if (cmdEql(command, "heapprof")) {
+        if (cmdEql(arg, "on")) {
+            heapprof_enable();
+            printf("Heap profiling enabled\n");
+        } else if (cmdEql(arg, "off")) {
+            heapprof_disable();
+            printf("Heap profiling disabled\n");
+        } else if (cmdEql(arg, "reset")) {
+            heapprof_reset();
+            printf("Heap profile cleared\n");
+        } else {
+            heapprof_print();
+        }
     } else if (cmdEql(command, "uptime")) {
         uint32 ticks = get_tick_count();
         uint32 seconds = ticks / 100;
@@ -176,6 +198,8 @@ void launch_shell(int n) {
         printf("s\n");
     } else if (cmdEql(command, "ps")) {
         list_processes();
+    } else if (cmdEql(command, "cpus")) {
+        smp_print_info();
     } else if (cmdEql(command, "devices")) {
         list_devices();
     } else if (cmdEql(command, "disks")) {
@@ -306,6 +330,7 @@ void launch_shell(int n) {
     } else if (cmdEql(command, "exit")) {        
         set_screen_color(0x0F, 0x00);
         printf("Exiting shell...\n");
+        arena_release(get_scratch_arena(), scratch_mark);
         return;
     } else {
         set_screen_color(0x0C, 0x00);
@@ -314,5 +339,6 @@ void launch_shell(int n) {
         printf("'. Type 'help' for a list of commands.\n");
         set_screen_color(0x07, 0x00);
     }
+    arena_release(get_scratch_arena(), scratch_mark);
     launch_shell(n + 1);
 }
\ No newline at end of file
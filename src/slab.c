@@ -0,0 +1,203 @@
+/*
+ * DaOS - Simple Operating System
+ * Copyright (C) 2025 Mostafizur Rahman
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "../include/slab.h"
+#include "../include/pmm.h"
+#include "../include/screen.h"
+#include "../include/util.h"
+
+static slab_cache_t slab_caches[SLAB_NUM_CLASSES];
+static int slab_initialized = 0;
+
+static uint32 slab_class_index(size_t size) {
+    if (size <= SLAB_MIN_SIZE) {
+        return 0;
+    }
+    return (32 - __builtin_clz((uint32)size - 1)) - 4;
+}
+
+static uint32 slab_objects_offset(uint32 object_size) {
+    return (sizeof(slab_t) + object_size - 1) & ~(object_size - 1);
+}
+
+static void slab_list_remove(slab_t** list, slab_t* slab) {
+    if (slab->prev) {
+        slab->prev->next = slab->next;
+    } else {
+        *list = slab->next;
+    }
+    if (slab->next) {
+        slab->next->prev = slab->prev;
+    }
+    slab->next = 0;
+    slab->prev = 0;
+}
+
+static void slab_list_push(slab_t** list, slab_t* slab) {
+    slab->prev = 0;
+    slab->next = *list;
+    if (*list) {
+        (*list)->prev = slab;
+    }
+    *list = slab;
+}
+
+static slab_t* slab_create(uint32 class_index) {
+    uint64 page = pmm_allocate_page();
+    if (page == 0) {
+        return 0;
+    }
+    
+    slab_cache_t* cache = &slab_caches[class_index];
+    slab_t* slab = (slab_t*)(uintptr)page;
+    uint32 offset = slab_objects_offset(cache->object_size);
+    
+    slab->magic = SLAB_MAGIC;
+    slab->size_class = class_index;
+    slab->in_use = 0;
+    slab->capacity = (SLAB_PAGE_SIZE - offset) / cache->object_size;
+    slab->free_list = 0;
+    slab->next = 0;
+    slab->prev = 0;
+    
+    for (int i = slab->capacity - 1; i >= 0; i--) {
+        void** object = (void**)((uintptr)slab + offset + i * cache->object_size);
+        *object = slab->free_list;
+        slab->free_list = object;
+    }
+    
+    cache->num_slabs++;
+    return slab;
+}
+
+void init_slab() {
+    for (int i = 0; i < SLAB_NUM_CLASSES; i++) {
+        slab_caches[i].object_size = SLAB_MIN_SIZE << i;
+        slab_caches[i].partial = 0;
+        slab_caches[i].full = 0;
+        slab_caches[i].empty = 0;
+        slab_caches[i].num_slabs = 0;
+        slab_caches[i].num_allocs = 0;
+        slab_caches[i].num_frees = 0;
+    }
+    slab_initialized = 1;
+}
+
+void* slab_alloc(size_t size) {
+    if (size == 0 || size > SLAB_MAX_SIZE) {
+        return 0;
+    }
+    
+    if (!slab_initialized) {
+        init_slab();
+    }
+    
+    uint32 class_index = slab_class_index(size);
+    slab_cache_t* cache = &slab_caches[class_index];
+    slab_t* slab = cache->partial;
+    
+    if (!slab) {
+        if (cache->empty) {
+            slab = cache->empty;
+            cache->empty = 0;
+        } else {
+            slab = slab_create(class_index);
+            if (!slab) {
+                return 0;
+            }
+        }
+        slab_list_push(&cache->partial, slab);
+    }
+    
+    void** object = (void**)slab->free_list;
+    slab->free_list = *object;
+    slab->in_use++;
+    
+    if (!slab->free_list) {
+        slab_list_remove(&cache->partial, slab);
+        slab_list_push(&cache->full, slab);
+    }
+    
+    cache->num_allocs++;
+    return object;
+}
+
+int slab_free(void* ptr) {
+    slab_t* slab = (slab_t*)((uintptr)ptr & ~(uintptr)(SLAB_PAGE_SIZE - 1));
+    
+    if (slab->magic != SLAB_MAGIC || slab->size_class >= SLAB_NUM_CLASSES) {
+        return 0;
+    }
+    
+    slab_cache_t* cache = &slab_caches[slab->size_class];
+    
+    if (!slab->free_list) {
+        slab_list_remove(&cache->full, slab);
+        slab_list_push(&cache->partial, slab);
+    }
+    
+    *(void**)ptr = slab->free_list;
+    slab->free_list = ptr;
+    slab->in_use--;
+    cache->num_frees++;
+    
+    if (slab->in_use == 0) {
+        slab_list_remove(&cache->partial, slab);
+        if (!cache->empty) {
+            cache->empty = slab;
+        } else {
+            slab->magic = 0;
+            cache->num_slabs--;
+            pmm_free_page((uintptr)slab);
+        }
+    }
+    
+    return 1;
+}
+
+uint32 slab_object_size(void* ptr) {
+    slab_t* slab = (slab_t*)((uintptr)ptr & ~(uintptr)(SLAB_PAGE_SIZE - 1));
+    
+    if (slab->magic != SLAB_MAGIC || slab->size_class >= SLAB_NUM_CLASSES) {
+        return 0;
+    }
+    
+    return slab_caches[slab->size_class].object_size;
+}
+
+void slab_print_stats() {
+    printf("Slab Caches:\n");
+    printf("  Size  Slabs Allocs Frees\n");
+    
+    for (int i = 0; i < SLAB_NUM_CLASSES; i++) {
+        char num_str[20];
+        printf("  ");
+        int_to_ascii(slab_caches[i].object_size, num_str);
+        printf(num_str);
+        printf("  ");
+        int_to_ascii(slab_caches[i].num_slabs, num_str);
+        printf(num_str);
+        printf("  ");
+        int_to_ascii(slab_caches[i].num_allocs, num_str);
+        printf(num_str);
+        printf("  ");
+        int_to_ascii(slab_caches[i].num_frees, num_str);
+        printf(num_str);
+        printf("\n");
+    }
+}
@@ -0,0 +1,194 @@
+; DaOS - Simple Operating System
+; Copyright (C) 2025 Mostafizur Rahman
+;
+; This program is free software: you can redistribute it and/or modify
+; it under the terms of the GNU General Public License as published by
+; the Free Software Foundation, either version 3 of the License, or
+; (at your option) any later version.
+;
+; This program is distributed in the hope that it will be useful,
+; but WITHOUT ANY WARRANTY; without even the implied warranty of
+; MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+; GNU General Public License for more details.
+;
+; You should have received a copy of the GNU General Public License
+; along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+
+global ap_trampoline_start
+global ap_trampoline_end
+global ap_trampoline_cr3
+global ap_trampoline_stack
+global ap_trampoline_cpu
+global apic_timer_entry
+global apic_spurious_entry
+global tlb_shootdown_entry
+
+extern ap_main
+extern apic_timer_handler
+extern tlb_shootdown_handler
+
+AP_TRAMPOLINE_BASE equ 0x8000
+%define TRAMPOLINE(label) (AP_TRAMPOLINE_BASE + (label) - ap_trampoline_start)
+
+section .text
+
+; Copied to AP_TRAMPOLINE_BASE; enters long mode straight from real mode
+bits 16
+ap_trampoline_start:
+    cli
+    cld
+    xor ax, ax
+    mov ds, ax
+    mov es, ax
+    mov ss, ax
+    
+    lgdt [TRAMPOLINE(ap_gdt.pointer)]
+    
+    mov eax, cr4
+    or eax, 1 << 5                ; PAE
+    mov cr4, eax
+    
+    mov eax, [TRAMPOLINE(ap_trampoline_cr3)]
+    mov cr3, eax
+    
+    mov ecx, 0xC0000080           ; EFER
+    rdmsr
+    or eax, 1 << 8                ; LME
+    wrmsr
+    
+    mov eax, cr0
+    or eax, (1 << 31) | 1         ; PG | PE
+    mov cr0, eax
+    
+    jmp dword 0x08:TRAMPOLINE(ap_trampoline_long)
+
+bits 64
+ap_trampoline_long:
+    xor ax, ax
+    mov ds, ax
+    mov es, ax
+    mov ss, ax
+    mov fs, ax
+    mov gs, ax
+    
+    mov rsp, [TRAMPOLINE(ap_trampoline_stack)]
+    mov rdi, [TRAMPOLINE(ap_trampoline_cpu)]
+    mov rax, ap_enter_kernel
+    jmp rax
+
+align 8
+ap_gdt:
+    dq 0
+    dq (1<<43) | (1<<44) | (1<<47) | (1<<53)
+.pointer:
+    dw $ - ap_gdt - 1
+    dd TRAMPOLINE(ap_gdt)
+
+align 8
+ap_trampoline_cr3:
+    dq 0
+ap_trampoline_stack:
+    dq 0
+ap_trampoline_cpu:
+    dq 0
+ap_trampoline_end:
+
+; Reload the kernel's own GDT copy so the AP no longer depends on low memory
+ap_enter_kernel:
+    lgdt [ap_gdt64.pointer]
+    push 0x08
+    mov rax, .reload_cs
+    push rax
+    retfq
+.reload_cs:
+    xor rbp, rbp
+    call ap_main
+.hang:
+    cli
+    hlt
+    jmp .hang
+
+apic_timer_entry:
+    push rax
+    push rbx
+    push rcx
+    push rdx
+    push rsi
+    push rdi
+    push rbp
+    push r8
+    push r9
+    push r10
+    push r11
+    push r12
+    push r13
+    push r14
+    push r15
+    
+    call apic_timer_handler
+    
+    pop r15
+    pop r14
+    pop r13
+    pop r12
+    pop r11
+    pop r10
+    pop r9
+    pop r8
+    pop rbp
+    pop rdi
+    pop rsi
+    pop rdx
+    pop rcx
+    pop rbx
+    pop rax
+    iretq
+
+tlb_shootdown_entry:
+    push rax
+    push rbx
+    push rcx
+    push rdx
+    push rsi
+    push rdi
+    push rbp
+    push r8
+    push r9
+    push r10
+    push r11
+    push r12
+    push r13
+    push r14
+    push r15
+    
+    call tlb_shootdown_handler
+    
+    pop r15
+    pop r14
+    pop r13
+    pop r12
+    pop r11
+    pop r10
+    pop r9
+    pop r8
+    pop rbp
+    pop rdi
+    pop rsi
+    pop rdx
+    pop rcx
+    pop rbx
+    pop rax
+    iretq
+
+apic_spurious_entry:
+    iretq
+
+section .rodata
+ap_gdt64:
+    dq 0
+.code: equ $ - ap_gdt64
+    dq (1<<43) | (1<<44) | (1<<47) | (1<<53)
+.pointer:
+    dw $ - ap_gdt64 - 1
+    dq ap_gdt64
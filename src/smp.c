@@ -0,0 +1,366 @@
+/*
+ * DaOS - Simple Operating System
+ * Copyright (C) 2025 Mostafizur Rahman
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "../include/smp.h"
+#include "../include/paging.h"
+#include "../include/pmm.h"
+#include "../include/idt.h"
+#include "../include/timer.h"
+#include "../include/screen.h"
+#include "../include/string.h"
+#include "../include/util.h"
+#include "../include/system.h"
+
+static cpu_t cpus[MAX_CPUS];
+static uint32 cpu_count = 1;
+static volatile uint32 online_mask = 1;
+static volatile uint32* lapic = 0;
+static uint32 lapic_timer_count = 0;
+
+#define TRAMPOLINE_VAR(sym) \
+    (*(uint64*)(AP_TRAMPOLINE_BASE + ((uint8*)&(sym) - ap_trampoline_start)))
+
+static inline uint64 rdmsr(uint32 msr) {
+    uint32 low, high;
+    __asm__ __volatile__("rdmsr" : "=a"(low), "=d"(high) : "c"(msr));
+    return ((uint64)high << 32) | low;
+}
+
+static inline void wrmsr(uint32 msr, uint64 value) {
+    __asm__ __volatile__("wrmsr" : : "c"(msr), "a"((uint32)value), "d"((uint32)(value >> 32)));
+}
+
+static inline uint32 lapic_read(uint32 reg) {
+    return lapic[reg / 4];
+}
+
+static inline void lapic_write(uint32 reg, uint32 value) {
+    lapic[reg / 4] = value;
+    (void)lapic[LAPIC_ID / 4];
+}
+
+void smp_init_bsp() {
+    cpus[0].self = &cpus[0];
+    cpus[0].id = 0;
+    cpus[0].apic_id = 0;
+    cpus[0].online = 1;
+    cpus[0].stack = 0;
+    
+    wrmsr(IA32_GS_BASE_MSR, (uintptr)&cpus[0]);
+}
+
+cpu_t* smp_this_cpu() {
+    cpu_t* cpu;
+    __asm__ __volatile__("movq %%gs:0, %0" : "=r"(cpu));
+    return cpu;
+}
+
+cpu_t* smp_get_cpu(uint32 id) {
+    return &cpus[id];
+}
+
+uint32 smp_cpu_count() {
+    return cpu_count;
+}
+
+uint32 smp_online_mask() {
+    return online_mask;
+}
+
+static void acpi_map(uint64 phys, uint32 size) {
+    for (uint64 page = phys & PAGE_FRAME; page < phys + size; page += PAGE_SIZE) {
+        if (!get_physical_address(page)) {
+            map_page(page, page, PAGE_PRESENT);
+        }
+    }
+}
+
+static int acpi_checksum(uint8* data, uint32 length) {
+    uint8 sum = 0;
+    for (uint32 i = 0; i < length; i++) {
+        sum += data[i];
+    }
+    return sum == 0;
+}
+
+static int acpi_signature(const char* field, const char* signature, uint32 length) {
+    for (uint32 i = 0; i < length; i++) {
+        if (field[i] != signature[i]) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static acpi_rsdp_t* acpi_scan_rsdp(uint64 start, uint64 end) {
+    for (uint64 addr = start; addr < end; addr += 16) {
+        acpi_rsdp_t* rsdp = (acpi_rsdp_t*)(uintptr)addr;
+        if (acpi_signature(rsdp->signature, "RSD PTR ", 8) && acpi_checksum((uint8*)rsdp, 20)) {
+            return rsdp;
+        }
+    }
+    return 0;
+}
+
+static acpi_rsdp_t* acpi_find_rsdp() {
+    uint64 ebda = (uint64)*(uint16*)0x40E << 4;
+    acpi_rsdp_t* rsdp = 0;
+    
+    if (ebda) {
+        rsdp = acpi_scan_rsdp(ebda, ebda + 1024);
+    }
+    if (!rsdp) {
+        rsdp = acpi_scan_rsdp(0xE0000, 0x100000);
+    }
+    return rsdp;
+}
+
+static acpi_header_t* acpi_table(uint64 phys) {
+    acpi_map(phys, sizeof(acpi_header_t));
+    acpi_header_t* header = (acpi_header_t*)(uintptr)phys;
+    acpi_map(phys, header->length);
+    return acpi_checksum((uint8*)header, header->length) ? header : 0;
+}
+
+static acpi_madt_t* acpi_find_madt() {
+    acpi_rsdp_t* rsdp = acpi_find_rsdp();
+    if (!rsdp) {
+        return 0;
+    }
+    
+    int xsdt = rsdp->revision >= 2 && rsdp->xsdt_address;
+    acpi_header_t* root = acpi_table(xsdt ? rsdp->xsdt_address : rsdp->rsdt_address);
+    if (!root) {
+        return 0;
+    }
+    
+    uint32 entry_size = xsdt ? 8 : 4;
+    uint32 entries = (root->length - sizeof(acpi_header_t)) / entry_size;
+    uint8* table = (uint8*)root + sizeof(acpi_header_t);
+    
+    for (uint32 i = 0; i < entries; i++) {
+        uint64 phys = xsdt ? *(uint64*)(table + i * 8) : *(uint32*)(table + i * 4);
+        acpi_header_t* header = acpi_table(phys);
+        if (header && acpi_signature(header->signature, "APIC", 4)) {
+            return (acpi_madt_t*)header;
+        }
+    }
+    
+    return 0;
+}
+
+static void madt_parse(acpi_madt_t* madt, uint32 bsp_apic_id) {
+    uint8* entry = (uint8*)madt + sizeof(acpi_madt_t);
+    uint8* end = (uint8*)madt + madt->header.length;
+    
+    while (entry < end) {
+        madt_entry_t* header = (madt_entry_t*)entry;
+        if (header->length == 0) {
+            break;
+        }
+        
+        if (header->type == MADT_TYPE_LOCAL_APIC) {
+            madt_local_apic_t* local = (madt_local_apic_t*)entry;
+            if ((local->flags & MADT_LAPIC_ENABLED) && local->apic_id != bsp_apic_id && cpu_count < MAX_CPUS) {
+                cpu_t* cpu = &cpus[cpu_count];
+                cpu->self = cpu;
+                cpu->id = cpu_count;
+                cpu->apic_id = local->apic_id;
+                cpu->online = 0;
+                cpu->stack = 0;
+                cpu_count++;
+            }
+        }
+        
+        entry += header->length;
+    }
+}
+
+static void lapic_enable() {
+    lapic_write(LAPIC_TPR, 0);
+    lapic_write(LAPIC_SVR, LAPIC_SVR_ENABLE | LAPIC_SPURIOUS_VECTOR);
+}
+
+void lapic_eoi() {
+    lapic_write(LAPIC_EOI, 0);
+}
+
+static void lapic_timer_calibrate() {
+    lapic_write(LAPIC_TIMER_DIVIDE, 0x3);
+    lapic_write(LAPIC_LVT_TIMER, LAPIC_TIMER_MASKED);
+    
+    uint32 start = get_tick_count();
+    while (get_tick_count() == start) {
+        __asm__ __volatile__("hlt");
+    }
+    
+    lapic_write(LAPIC_TIMER_INITIAL, 0xFFFFFFFF);
+    start = get_tick_count();
+    while (get_tick_count() - start < 10) {
+        __asm__ __volatile__("hlt");
+    }
+    
+    lapic_timer_count = (0xFFFFFFFF - lapic_read(LAPIC_TIMER_CURRENT)) / 10;
+    lapic_write(LAPIC_TIMER_INITIAL, 0);
+}
+
+static void lapic_timer_start() {
+    lapic_write(LAPIC_TIMER_DIVIDE, 0x3);
+    lapic_write(LAPIC_LVT_TIMER, LAPIC_TIMER_PERIODIC | LAPIC_TIMER_VECTOR);
+    lapic_write(LAPIC_TIMER_INITIAL, lapic_timer_count);
+}
+
+static void lapic_send_ipi(uint32 apic_id, uint32 command) {
+    lapic_write(LAPIC_ICR_HIGH, apic_id << 24);
+    lapic_write(LAPIC_ICR_LOW, command);
+    while (lapic_read(LAPIC_ICR_LOW) & LAPIC_ICR_PENDING) {
+        __asm__ __volatile__("pause");
+    }
+}
+
+void smp_send_ipi(uint32 mask, uint32 vector) {
+    for (uint32 id = 0; id < cpu_count; id++) {
+        if (mask & (1u << id)) {
+            lapic_send_ipi(cpus[id].apic_id, vector);
+        }
+    }
+}
+
+void apic_timer_handler() {
+    lapic_eoi();
+    schedule_irq();
+}
+
+void tlb_shootdown_handler() {
+    tlb_shootdown_service();
+    lapic_eoi();
+}
+
+void ap_main(cpu_t* cpu) {
+    wrmsr(IA32_GS_BASE_MSR, (uintptr)cpu);
+    paging_init_ap();
+    __asm__ __volatile__("lidt (%0)" : : "r"(&idt_reg));
+    
+    lapic_enable();
+    sched_init_cpu(cpu->id);
+    lapic_timer_start();
+    
+    cpu->online = 1;
+    __sync_fetch_and_or(&online_mask, 1u << cpu->id);
+    
+    __asm__ __volatile__("sti");
+    sched_idle_loop();
+}
+
+static int smp_boot_ap(cpu_t* cpu) {
+    uint64 stack = pmm_allocate_pages(AP_STACK_PAGES);
+    if (!stack) {
+        return -1;
+    }
+    cpu->stack = stack + AP_STACK_PAGES * PAGE_SIZE;
+    
+    TRAMPOLINE_VAR(ap_trampoline_cr3) = get_kernel_directory()->physical_addr;
+    TRAMPOLINE_VAR(ap_trampoline_stack) = cpu->stack;
+    TRAMPOLINE_VAR(ap_trampoline_cpu) = (uintptr)cpu;
+    
+    lapic_send_ipi(cpu->apic_id, LAPIC_ICR_INIT);
+    sleep(1);
+    
+    for (int attempt = 0; attempt < 2 && !cpu->online; attempt++) {
+        lapic_send_ipi(cpu->apic_id, LAPIC_ICR_STARTUP | (AP_TRAMPOLINE_BASE >> 12));
+        sleep(1);
+    }
+    
+    uint32 start = get_tick_count();
+    while (!cpu->online && get_tick_count() - start < AP_STARTUP_TIMEOUT) {
+        __asm__ __volatile__("hlt");
+    }
+    
+    if (!cpu->online) {
+        lapic_send_ipi(cpu->apic_id, LAPIC_ICR_INIT);
+        return -1;
+    }
+    return 0;
+}
+
+void init_smp() {
+    uint32 eax, ebx, ecx, edx;
+    cpuid(1, &eax, &ebx, &ecx, &edx);
+    if (!((edx >> 9) & 1)) {
+        return;
+    }
+    
+    acpi_madt_t* madt = acpi_find_madt();
+    uint64 lapic_base = rdmsr(IA32_APIC_BASE_MSR) & PAGE_FRAME;
+    if (!lapic_base) {
+        lapic_base = madt ? madt->lapic_address : LAPIC_DEFAULT_BASE;
+    }
+    
+    map_page(lapic_base, lapic_base, PAGE_PRESENT | PAGE_WRITE | PAGE_CACHE_DISABLE);
+    lapic = (volatile uint32*)(uintptr)lapic_base;
+    
+    cpus[0].apic_id = lapic_read(LAPIC_ID) >> 24;
+    lapic_enable();
+    
+    set_idt_gate(LAPIC_TIMER_VECTOR, (uint64)apic_timer_entry);
+    set_idt_gate(TLB_SHOOTDOWN_VECTOR, (uint64)tlb_shootdown_entry);
+    set_idt_gate(LAPIC_SPURIOUS_VECTOR, (uint64)apic_spurious_entry);
+    
+    if (!madt) {
+        return;
+    }
+    
+    madt_parse(madt, cpus[0].apic_id);
+    if (cpu_count == 1) {
+        return;
+    }
+    
+    lapic_timer_calibrate();
+    memcpy((void*)AP_TRAMPOLINE_BASE, ap_trampoline_start, ap_trampoline_end - ap_trampoline_start);
+    
+    for (uint32 i = 1; i < cpu_count; i++) {
+        smp_boot_ap(&cpus[i]);
+    }
+}
+
+void smp_print_info() {
+    printf("CPUs: ");
+    char count_str[10];
+    int_to_ascii(cpu_count, count_str);
+    printf(count_str);
+    printf("\n");
+    
+    for (uint32 i = 0; i < cpu_count; i++) {
+        char id_str[10];
+        printf("  CPU ");
+        int_to_ascii(cpus[i].id, id_str);
+        printf(id_str);
+        
+        printf(" APIC ");
+        char apic_str[10];
+        int_to_ascii(cpus[i].apic_id, apic_str);
+        printf(apic_str);
+        
+        printf(cpus[i].online ? " online, " : " offline, ");
+        
+        char running_str[10];
+        int_to_ascii(cpus[i].rq.nr_running, running_str);
+        printf(running_str);
+        printf(" runnable\n");
+    }
+}
@@ -0,0 +1,50 @@
+; DaOS - Simple Operating System
+; Copyright (C) 2025 Mostafizur Rahman
+;
+; This program is free software: you can redistribute it and/or modify
+; it under the terms of the GNU General Public License as published by
+; the Free Software Foundation, either version 3 of the License, or
+; (at your option) any later version.
+;
+; This program is distributed in the hope that it will be useful,
+; but WITHOUT ANY WARRANTY; without even the implied warranty of
+; MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+; GNU General Public License for more details.
+;
+; You should have received a copy of the GNU General Public License
+; along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+global switch_context
+global process_start
+
+extern process_bootstrap
+
+; void switch_context(uint64* old_rsp, uint64 new_rsp)
+switch_context:
+    pushfq
+    push rbp
+    push rbx
+    push r12
+    push r13
+    push r14
+    push r15
+    
+    mov [rdi], rsp
+    mov rsp, rsi
+    
+    pop r15
+    pop r14
+    pop r13
+    pop r12
+    pop rbx
+    pop rbp
+    popfq
+    ret
+
+; First return target of a new process; r12 holds its entry point
+process_start:
+    mov rdi, r12
+    call process_bootstrap
+.hang:
+    hlt
+    jmp .hang
@@ -37,3 +37,19 @@ uint16 inportw (uint16 _port) {
 void outportw (uint16 _port, uint16 _data) {
     __asm__ __volatile__ ("outw %0, %1" : : "a"(_data), "Nd"(_port));
 }
+
+void cpuid (uint32 leaf, uint32* eax, uint32* ebx, uint32* ecx, uint32* edx) {
+    __asm__ __volatile__ ("cpuid" : "=a"(*eax), "=b"(*ebx), "=c"(*ecx), "=d"(*edx) : "a"(leaf), "c"(0));
+}
+
+uint64 irq_save () {
+    uint64 flags;
+    __asm__ __volatile__ ("pushfq; popq %0; cli" : "=r"(flags) : : "memory");
+    return flags;
+}
+
+void irq_restore (uint64 flags) {
+    if (flags & 0x200) {
+        __asm__ __volatile__ ("sti" : : : "memory");
+    }
+}
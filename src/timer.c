@@ -19,11 +19,146 @@
 #include "../include/timer.h"
 #include "../include/irq.h"
 #include "../include/system.h"
+#include "../include/spinlock.h"
 
 static uint32 tick = 0;
+static uint32 wheel_tick = 0;
+static timer_entry_t* wheel[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SIZE];
+static timer_entry_t* expired_list = 0;
+static spinlock_t timer_lock = SPINLOCK_INIT;
+
+static void wheel_insert(timer_entry_t* timer) {
+    uint32 expires = timer->expires;
+    uint32 delta = expires - wheel_tick;
+    timer_entry_t** slot;
+    
+    if ((int32)delta < 0) {
+        slot = &wheel[0][wheel_tick & TIMER_WHEEL_MASK];
+    } else if (delta < (1u << TIMER_WHEEL_BITS)) {
+        slot = &wheel[0][expires & TIMER_WHEEL_MASK];
+    } else if (delta < (1u << (TIMER_WHEEL_BITS * 2))) {
+        slot = &wheel[1][(expires >> TIMER_WHEEL_BITS) & TIMER_WHEEL_MASK];
+    } else if (delta < (1u << (TIMER_WHEEL_BITS * 3))) {
+        slot = &wheel[2][(expires >> (TIMER_WHEEL_BITS * 2)) & TIMER_WHEEL_MASK];
+    } else {
+        if (delta >= TIMER_WHEEL_SPAN) {
+            expires = wheel_tick + TIMER_WHEEL_SPAN - 1;
+            timer->expires = expires;
+        }
+        slot = &wheel[3][(expires >> (TIMER_WHEEL_BITS * 3)) & TIMER_WHEEL_MASK];
+    }
+    
+    timer->prev = 0;
+    timer->next = *slot;
+    if (*slot) {
+        (*slot)->prev = timer;
+    }
+    *slot = timer;
+    timer->slot = slot;
+}
+
+static uint32 cascade(uint32 level) {
+    uint32 index = (wheel_tick >> (TIMER_WHEEL_BITS * level)) & TIMER_WHEEL_MASK;
+    timer_entry_t* timer = wheel[level][index];
+    wheel[level][index] = 0;
+    
+    while (timer) {
+        timer_entry_t* next = timer->next;
+        wheel_insert(timer);
+        timer = next;
+    }
+    
+    return index;
+}
+
+static void wheel_remove(timer_entry_t* timer) {
+    if (timer->prev) {
+        timer->prev->next = timer->next;
+    } else {
+        *timer->slot = timer->next;
+    }
+    if (timer->next) {
+        timer->next->prev = timer->prev;
+    }
+    timer->next = 0;
+    timer->prev = 0;
+    timer->slot = 0;
+}
+
+void timer_add(timer_entry_t* timer, uint32 expires, void (*callback)(void* data), void* data) {
+    uint64 flags = spin_lock_irqsave(&timer_lock);
+    
+    if (timer->slot) {
+        wheel_remove(timer);
+    }
+    
+    timer->expires = expires;
+    timer->callback = callback;
+    timer->data = data;
+    wheel_insert(timer);
+    
+    spin_unlock_irqrestore(&timer_lock, flags);
+}
+
+void timer_cancel(timer_entry_t* timer) {
+    uint64 flags = spin_lock_irqsave(&timer_lock);
+    
+    if (timer->slot) {
+        wheel_remove(timer);
+    }
+    
+    spin_unlock_irqrestore(&timer_lock, flags);
+}
+
+int timer_pending(timer_entry_t* timer) {
+    return timer->slot != 0;
+}
+
+void timer_run() {
+    uint64 flags = spin_lock_irqsave(&timer_lock);
+    
+    while ((int32)(tick - wheel_tick) >= 0) {
+        uint32 index = wheel_tick & TIMER_WHEEL_MASK;
+        
+        if (!index && !cascade(1) && !cascade(2)) {
+            cascade(3);
+        }
+        
+        wheel_tick++;
+        
+        timer_entry_t* timer = wheel[0][index];
+        wheel[0][index] = 0;
+        
+        while (timer) {
+            timer_entry_t* next = timer->next;
+            timer->prev = 0;
+            timer->next = expired_list;
+            if (expired_list) {
+                expired_list->prev = timer;
+            }
+            expired_list = timer;
+            timer->slot = &expired_list;
+            timer = next;
+        }
+    }
+    
+    while (expired_list) {
+        timer_entry_t* timer = expired_list;
+        void (*callback)(void* data) = timer->callback;
+        void* data = timer->data;
+        wheel_remove(timer);
+        
+        spin_unlock_irqrestore(&timer_lock, flags);
+        callback(data);
+        flags = spin_lock_irqsave(&timer_lock);
+    }
+    
+    spin_unlock_irqrestore(&timer_lock, flags);
+}
 
 void timer_handler() {
     tick++;
+    timer_run();
 }
 
 void init_timer(uint32 frequency) {
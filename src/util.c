@@ -17,6 +17,10 @@
  */
 
 #include "../include/util.h"
+#include "../include/arena.h"
+
+static uint8 scratch_buffer[SCRATCH_ARENA_SIZE];
+static arena_t scratch_arena;
 
 void memory_copy(char *source, char *dest, int nbytes) {
     for (int i = 0; i < nbytes; i++) {
@@ -75,10 +79,17 @@ void uint_to_hex(uint32 n, char str[]) {
     str[8] = '\0';
 }
 
-void * malloc(int nbytes) {      
-    static uint8 *heap = (uint8 *)0x200000;
-    uint8 *prev_heap = heap;
-    heap += nbytes;
-    return prev_heap;
+arena_t* get_scratch_arena() {
+    if (!scratch_arena.base) {
+        arena_init(&scratch_arena, scratch_buffer, SCRATCH_ARENA_SIZE);
+    }
+    return &scratch_arena;
+}
+
+void * malloc(int nbytes) {
+    if (nbytes < 0) {
+        return 0;
+    }
+    return arena_alloc(get_scratch_arena(), nbytes);
 }
 
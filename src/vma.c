@@ -0,0 +1,95 @@
+/*
+ * DaOS - Simple Operating System
+ * Copyright (C) 2025 Mostafizur Rahman
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "../include/vma.h"
+#include "../include/memory.h"
+
+vma_t* vma_find(vma_t* list, uint64 addr) {
+    for (vma_t* vma = list; vma && vma->start <= addr; vma = vma->next) {
+        if (addr < vma->end) {
+            return vma;
+        }
+    }
+    return 0;
+}
+
+vma_t* vma_insert(vma_t** list, uint64 start, uint64 end, uint64 flags) {
+    if (start >= end) {
+        return 0;
+    }
+    
+    vma_t** link = list;
+    while (*link && (*link)->end <= start) {
+        link = &(*link)->next;
+    }
+    if (*link && (*link)->start < end) {
+        return 0;
+    }
+    
+    vma_t* vma = (vma_t*)kmalloc(sizeof(vma_t));
+    if (!vma) {
+        return 0;
+    }
+    
+    vma->start = start;
+    vma->end = end;
+    vma->flags = flags;
+    vma->next = *link;
+    *link = vma;
+    
+    return vma;
+}
+
+void vma_remove(vma_t** list, vma_t* vma) {
+    for (vma_t** link = list; *link; link = &(*link)->next) {
+        if (*link == vma) {
+            *link = vma->next;
+            kfree(vma);
+            return;
+        }
+    }
+}
+
+vma_t* vma_clone(vma_t* list) {
+    vma_t* head = 0;
+    vma_t** tail = &head;
+    
+    for (vma_t* vma = list; vma; vma = vma->next) {
+        vma_t* copy = (vma_t*)kmalloc(sizeof(vma_t));
+        if (!copy) {
+            vma_free_all(&head);
+            return 0;
+        }
+        copy->start = vma->start;
+        copy->end = vma->end;
+        copy->flags = vma->flags;
+        copy->next = 0;
+        *tail = copy;
+        tail = &copy->next;
+    }
+    
+    return head;
+}
+
+void vma_free_all(vma_t** list) {
+    while (*list) {
+        vma_t* next = (*list)->next;
+        kfree(*list);
+        *list = next;
+    }
+}
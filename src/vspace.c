@@ -0,0 +1,190 @@
+/*
+ * DaOS - Simple Operating System
+ * Copyright (C) 2025 Mostafizur Rahman
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "../include/vspace.h"
+#include "../include/memory.h"
+
+static void vspace_insert_addr(vspace_t* space, vspace_extent_t* extent) {
+    rb_node_t** link = &space->by_addr.node;
+    rb_node_t* parent = 0;
+    
+    while (*link) {
+        parent = *link;
+        if (extent->start < rb_entry(parent, vspace_extent_t, addr_node)->start) {
+            link = &parent->left;
+        } else {
+            link = &parent->right;
+        }
+    }
+    
+    rb_link_node(&extent->addr_node, parent, link);
+    rb_insert_color(&extent->addr_node, &space->by_addr);
+}
+
+static void vspace_insert_size(vspace_t* space, vspace_extent_t* extent) {
+    rb_node_t** link = &space->by_size.node;
+    rb_node_t* parent = 0;
+    
+    while (*link) {
+        parent = *link;
+        vspace_extent_t* other = rb_entry(parent, vspace_extent_t, size_node);
+        if (extent->size < other->size || (extent->size == other->size && extent->start < other->start)) {
+            link = &parent->left;
+        } else {
+            link = &parent->right;
+        }
+    }
+    
+    rb_link_node(&extent->size_node, parent, link);
+    rb_insert_color(&extent->size_node, &space->by_size);
+}
+
+static void vspace_resize(vspace_t* space, vspace_extent_t* extent, uint64 start, uint64 size) {
+    rb_erase(&extent->size_node, &space->by_size);
+    extent->start = start;
+    extent->size = size;
+    vspace_insert_size(space, extent);
+}
+
+static void vspace_remove(vspace_t* space, vspace_extent_t* extent) {
+    rb_erase(&extent->addr_node, &space->by_addr);
+    rb_erase(&extent->size_node, &space->by_size);
+    space->extent_count--;
+    kfree(extent);
+}
+
+static vspace_extent_t* vspace_find_fit(vspace_t* space, uint64 size) {
+    rb_node_t* node = space->by_size.node;
+    vspace_extent_t* best = 0;
+    
+    while (node) {
+        vspace_extent_t* extent = rb_entry(node, vspace_extent_t, size_node);
+        if (extent->size >= size) {
+            best = extent;
+            node = node->left;
+        } else {
+            node = node->right;
+        }
+    }
+    
+    return best;
+}
+
+static vspace_extent_t* vspace_find_before(vspace_t* space, uint64 addr) {
+    rb_node_t* node = space->by_addr.node;
+    vspace_extent_t* found = 0;
+    
+    while (node) {
+        vspace_extent_t* extent = rb_entry(node, vspace_extent_t, addr_node);
+        if (extent->start <= addr) {
+            found = extent;
+            node = node->right;
+        } else {
+            node = node->left;
+        }
+    }
+    
+    return found;
+}
+
+int vspace_init(vspace_t* space, uint64 base, uint64 size) {
+    space->by_addr.node = 0;
+    space->by_size.node = 0;
+    space->base = base;
+    space->limit = base + size;
+    space->free_bytes = 0;
+    space->extent_count = 0;
+    
+    vspace_free(space, base, size);
+    return space->extent_count == 1 ? 0 : -1;
+}
+
+uint64 vspace_alloc(vspace_t* space, uint64 size) {
+    if (size == 0) {
+        return 0;
+    }
+    
+    vspace_extent_t* extent = vspace_find_fit(space, size);
+    if (!extent) {
+        return 0;
+    }
+    
+    uint64 start = extent->start;
+    if (extent->size == size) {
+        vspace_remove(space, extent);
+    } else {
+        vspace_resize(space, extent, start + size, extent->size - size);
+    }
+    
+    space->free_bytes -= size;
+    return start;
+}
+
+void vspace_free(vspace_t* space, uint64 start, uint64 size) {
+    if (size == 0 || start < space->base || start + size > space->limit) {
+        return;
+    }
+    
+    vspace_extent_t* prev = vspace_find_before(space, start);
+    vspace_extent_t* next;
+    
+    if (prev) {
+        rb_node_t* node = rb_next(&prev->addr_node);
+        next = node ? rb_entry(node, vspace_extent_t, addr_node) : 0;
+    } else {
+        rb_node_t* node = rb_first(&space->by_addr);
+        next = node ? rb_entry(node, vspace_extent_t, addr_node) : 0;
+    }
+    
+    if ((prev && prev->start + prev->size > start) || (next && start + size > next->start)) {
+        return;
+    }
+    
+    space->free_bytes += size;
+    
+    if (prev && prev->start + prev->size == start) {
+        if (next && start + size == next->start) {
+            size += next->size;
+            vspace_remove(space, next);
+        }
+        vspace_resize(space, prev, prev->start, prev->size + size);
+        return;
+    }
+    
+    if (next && start + size == next->start) {
+        vspace_resize(space, next, start, next->size + size);
+        return;
+    }
+    
+    vspace_extent_t* extent = (vspace_extent_t*)kmalloc(sizeof(vspace_extent_t));
+    if (!extent) {
+        space->free_bytes -= size;
+        return;
+    }
+    
+    extent->start = start;
+    extent->size = size;
+    vspace_insert_addr(space, extent);
+    vspace_insert_size(space, extent);
+    space->extent_count++;
+}
+
+uint64 vspace_largest_free(vspace_t* space) {
+    rb_node_t* node = rb_last(&space->by_size);
+    return node ? rb_entry(node, vspace_extent_t, size_node)->size : 0;
+}